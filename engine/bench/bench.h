@@ -0,0 +1,112 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../src/core/types.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cfloat>
+
+NS_BEGIN
+
+struct BenchResult {
+	String name;
+	u64 count;
+	double avgMs, minMs;
+	u64 entities{ 0 }; ///< World size the run was measured at, if any
+
+	double nsPerItem() const { return count > 0 ? (minMs * 1e6) / double(count) : 0.0; }
+};
+
+/// Keeps the optimizer from throwing away benchmarked work: the value has to exist, in a
+/// register or in memory, and memory writes before the call must happen.
+template <typename T>
+inline void benchSink(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile T sink;
+	sink = value;
+	(void) sink;
+#endif
+}
+
+/// Runs 'fn' once to warm up, then 'iterations' more times. 'setup' runs (untimed) before
+/// each of them, for benchmarks that consume their input.
+/// 'count' is the number of items processed per run, used for per-item timings.
+template <typename S, typename F>
+BenchResult benchRun(const String& name, u64 count, u32 iterations, S&& setup, F&& fn) {
+	using Clock = std::chrono::high_resolution_clock;
+
+	setup();
+	fn();
+
+	double total = 0.0, best = DBL_MAX;
+	for (u32 i = 0; i < iterations; i++) {
+		setup();
+		auto start = Clock::now();
+		fn();
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		total += ms;
+		best = std::min(best, ms);
+	}
+
+	BenchResult res;
+	res.name = name;
+	res.count = count;
+	res.avgMs = total / double(std::max(iterations, 1u));
+	res.minMs = best;
+	return res;
+}
+
+template <typename F>
+BenchResult benchRun(const String& name, u64 count, u32 iterations, F&& fn) {
+	return benchRun(name, count, iterations, []() {}, fn);
+}
+
+inline void benchPrint(const BenchResult& res) {
+	std::printf(
+		"%-48s %10llu %12.4f ms %12.4f ms %10.2f ns/item\n",
+		res.name.c_str(), (unsigned long long) res.count, res.avgMs, res.minMs, res.nsPerItem()
+	);
+}
+
+/// Machine readable output, one record per result.
+inline bool benchWriteCSV(const String& path, const Vector<BenchResult>& results) {
+	FILE* fp = std::fopen(path.c_str(), "w");
+	if (!fp) return false;
+
+	std::fprintf(fp, "name,entities,count,avg_ms,min_ms,ns_per_item\n");
+	for (const BenchResult& res : results) {
+		std::fprintf(
+			fp, "\"%s\",%llu,%llu,%.6f,%.6f,%.4f\n",
+			res.name.c_str(), (unsigned long long) res.entities, (unsigned long long) res.count,
+			res.avgMs, res.minMs, res.nsPerItem()
+		);
+	}
+	std::fclose(fp);
+	return true;
+}
+
+inline bool benchWriteJSON(const String& path, const Vector<BenchResult>& results) {
+	FILE* fp = std::fopen(path.c_str(), "w");
+	if (!fp) return false;
+
+	std::fprintf(fp, "[\n");
+	for (u32 i = 0; i < results.size(); i++) {
+		const BenchResult& res = results[i];
+		std::fprintf(
+			fp, "  { \"name\": \"%s\", \"entities\": %llu, \"count\": %llu, "
+				"\"avg_ms\": %.6f, \"min_ms\": %.6f, \"ns_per_item\": %.4f }%s\n",
+			res.name.c_str(), (unsigned long long) res.entities, (unsigned long long) res.count,
+			res.avgMs, res.minMs, res.nsPerItem(), i + 1 < results.size() ? "," : ""
+		);
+	}
+	std::fprintf(fp, "]\n");
+	std::fclose(fp);
+	return true;
+}
+
+NS_END
+
+#endif // BENCH_H
@@ -0,0 +1,253 @@
+#include "bench.h"
+
+#include "../src/core/ecs.h"
+
+#include <cstring>
+#include <random>
+
+struct Position : public Component { float x = 0, y = 0, z = 0; };
+struct Velocity : public Component { float x = 1, y = 1, z = 1; };
+struct Health : public Component { float value = 100.0f; };
+struct Mass : public Component { float value = 1.0f; };
+struct Marker : public Component {};
+
+static Vector<BenchResult> g_results;
+
+static void record(BenchResult res, u32 entities) {
+	res.entities = entities;
+	benchPrint(res);
+	g_results.push_back(res);
+}
+
+// Marks every entity that gets a Position, by recording a command from the notification
+struct MarkOnPosition : public EntitySystem {
+	MarkOnPosition() { watches<Position>(); }
+	void entityCreated(EntityWorld& world, Entity& ent) override {
+		world.commands().assign<Marker>(ent.id());
+	}
+};
+
+/// Commands recorded by handlers while the buffers are played back must be applied by the same playback.
+static bool checkPlaybackReentry() {
+	EntityWorld world;
+	world.registerSystem<MarkOnPosition>();
+
+	// Handlers run while applying an assign to an entity the systems already know
+	EntityList known;
+	for (u32 i = 0; i < 100; i++) known.push_back(&world.create());
+	world.playbackCommands();
+	for (Entity* ent : known) world.commands().assign<Position>(ent->id());
+
+	// and while announcing entities created by the buffer itself
+	for (u32 i = 0; i < 100; i++) {
+		CommandBuffer::Pending p = world.commands().create();
+		world.commands().assign<Position>(p);
+	}
+	world.playbackCommands();
+
+	u32 marked = 0;
+	world.each([&](Entity& ent, Position& p, Marker& m) { marked++; });
+	return marked == 200;
+}
+
+static void registerPosition(EntityWorld& world, u32 floats) {
+	world.registerSerializer<Position>("Position", 1,
+		[](SnapshotWriter& out, const Position& p) { out.write(p.x); out.write(p.y); out.write(p.z); },
+		[floats](SnapshotReader& in, Position& p, u32) {
+			p.x = in.read<float>();
+			for (u32 i = 1; i < floats; i++) p.y = in.read<float>();
+		}
+	);
+}
+
+/// A snapshot loads back whole. Truncated, inconsistent or unreadable ones are rejected and
+/// leave the world as it was.
+static bool checkSnapshots() {
+	const u32 count = 1000;
+	EntityWorld source;
+	registerPosition(source, 3);
+	for (u32 i = 0; i < count; i++) {
+		Entity& ent = source.create(Util::strCat("e", i));
+		ent.assign<Position>().x = float(i);
+		ent.assign<Velocity>();
+	}
+	Vector<u8> snap = source.saveSnapshot();
+
+	auto load = [](const Vector<u8>& data, u32 floats, u32& alive) {
+		EntityWorld world;
+		registerPosition(world, floats);
+		world.create("existing");
+		bool ok = world.loadSnapshot(data.data(), data.size());
+		alive = world.entities().size();
+		return ok;
+	};
+
+	u32 alive = 0;
+	if (!load(snap, 3, alive) || alive != count + 1) return false;
+
+	for (u64 size = 0; size < snap.size(); size += 7) {
+		Vector<u8> cut(snap.begin(), snap.begin() + size);
+		if (load(cut, 3, alive) || alive != 1) return false;
+	}
+
+	// Header (16 bytes) and the one type ("Position", 16 bytes), then the rows of the only block
+	Vector<u8> hostile = snap;
+	u32 rows;
+	std::memcpy(&rows, hostile.data() + 32, sizeof(u32));
+	if (rows != count) return false;
+	rows = 0xFFFFFFFF;
+	std::memcpy(hostile.data() + 32, &rows, sizeof(u32));
+	if (load(hostile, 3, alive) || alive != 1) return false;
+
+	// Well formed, but the component data is too short for this loader: entities are rolled back
+	return !load(snap, 4, alive) && alive == 1;
+}
+
+static void printPools(const char* when, const EntityWorld& world) {
+	std::printf("   pools %s\n", when);
+	for (const ComponentPoolStats& s : world.poolStats()) {
+		std::printf("   %-24s live %8u  capacity %8u  parked %4u (%8u slots)  heap blocks %4u  occupancy %5.1f%%  fragmentation %5.1f%%\n",
+					s.name.c_str(), s.live, s.capacity, s.freeBlocks, s.freeCapacity, s.heapBlocks,
+					s.occupancy() * 100.0f, s.fragmentation() * 100.0f);
+	}
+}
+
+static void populate(EntityWorld& world, u32 count) {
+	world.reserve<Position, Velocity, Health, Mass>(count);
+	for (u32 i = 0; i < count; i++) {
+		Entity& ent = world.create();
+		ent.assign<Position>();
+		ent.assign<Velocity>();
+		ent.assign<Health>();
+		ent.assign<Mass>();
+	}
+}
+
+static void runStructural(u32 count, u32 iterations) {
+	uptr<EntityWorld> world;
+
+	record(benchRun("create", count, iterations,
+		[&]() { world.reset(new EntityWorld()); },
+		[&]() {
+			for (u32 i = 0; i < count; i++) world->create();
+		}
+	), count);
+
+	record(benchRun("assign<Position>", count, iterations,
+		[&]() {
+			world.reset(new EntityWorld());
+			for (u32 i = 0; i < count; i++) world->create();
+		},
+		[&]() {
+			for (Entity* ent : world->entities()) ent->assign<Position>();
+		}
+	), count);
+
+	EntityList victims;
+	record(benchRun("destroy", count, iterations,
+		[&]() {
+			world.reset(new EntityWorld());
+			populate(*world, count);
+			world->update(0.0f);
+			victims = world->entities();
+		},
+		[&]() {
+			for (Entity* ent : victims) world->destroy(*ent);
+		}
+	), count);
+	printPools("after destroy", *world);
+
+	world.reset();
+}
+
+static void runQueries(u32 count, u32 iterations) {
+	EntityWorld world;
+	populate(world, count);
+	world.create().assign<Marker>();
+	world.update(0.0f);
+	printPools("after populate", world);
+
+	record(benchRun("each<1>", count, iterations, [&]() {
+		float acc = 0.0f;
+		world.each([&](Entity& ent, Position& p) { acc += p.x; });
+		benchSink(acc);
+	}), count);
+
+	record(benchRun("each<2>", count, iterations, [&]() {
+		float acc = 0.0f;
+		world.each([&](Entity& ent, Position& p, Velocity& v) { p.x += v.x; acc += p.x; });
+		benchSink(acc);
+	}), count);
+
+	record(benchRun("each<3>", count, iterations, [&]() {
+		float acc = 0.0f;
+		world.each([&](Entity& ent, Position& p, Velocity& v, Health& h) {
+			p.x += v.x; acc += p.x * h.value;
+		});
+		benchSink(acc);
+	}), count);
+
+	record(benchRun("each<4>", count, iterations, [&]() {
+		float acc = 0.0f;
+		world.each([&](Entity& ent, Position& p, Velocity& v, Health& h, Mass& m) {
+			p.x += v.x * m.value; acc += p.x * h.value;
+		});
+		benchSink(acc);
+	}), count);
+
+	Vector<u64> ids;
+	for (Entity* ent : world.entities()) ids.push_back(ent->id());
+	std::shuffle(ids.begin(), ids.end(), std::mt19937(1234));
+
+	record(benchRun("getEntity", count, iterations, [&]() {
+		u64 acc = 0;
+		for (u64 id : ids) acc += world.getEntity(id)->index();
+		benchSink(acc);
+	}), count);
+
+	const u32 finds = 1000;
+	record(benchRun("find<C>", finds, iterations, [&]() {
+		u64 acc = 0;
+		for (u32 i = 0; i < finds; i++) acc += world.find<Marker>()->index();
+		benchSink(acc);
+	}), count);
+}
+
+int main(int argc, char** argv) {
+	String jsonPath, csvPath;
+	u32 maxCount = 1000000;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "--json") == 0) jsonPath = argv[i + 1];
+		else if (std::strcmp(argv[i], "--csv") == 0) csvPath = argv[i + 1];
+		else if (std::strcmp(argv[i], "--max") == 0) maxCount = std::stoul(argv[i + 1]);
+	}
+
+	if (!checkPlaybackReentry()) {
+		std::fprintf(stderr, "Commands recorded during playback were lost\n");
+		return 1;
+	}
+	if (!checkSnapshots()) {
+		std::fprintf(stderr, "Snapshot loading accepted bad data or didn't round-trip\n");
+		return 1;
+	}
+
+	std::printf("%-48s %10s %15s %15s %18s\n", "benchmark", "items", "avg", "min", "per item");
+	for (u32 count : { 1000u, 10000u, 100000u, 1000000u }) {
+		if (count > maxCount) break;
+
+		std::printf("-- %u entities\n", count);
+		u32 iterations = count >= 1000000 ? 3 : 10;
+		runStructural(count, iterations);
+		runQueries(count, iterations);
+	}
+
+	if (!jsonPath.empty() && !benchWriteJSON(jsonPath, g_results)) {
+		std::fprintf(stderr, "Failed to write %s\n", jsonPath.c_str());
+		return 1;
+	}
+	if (!csvPath.empty() && !benchWriteCSV(csvPath, g_results)) {
+		std::fprintf(stderr, "Failed to write %s\n", csvPath.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,153 @@
+#include "bench.h"
+
+#include "../src/math/aabb_tree.h"
+
+#include <cstring>
+#include <random>
+
+static Vector<BenchResult> g_results;
+
+static void record(BenchResult res, u32 count) {
+	res.entities = count;
+	benchPrint(res);
+	g_results.push_back(res);
+}
+
+static void run(u32 count, u32 iterations) {
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> pos(-500.0f, 500.0f), size(0.5f, 2.0f), jitter(-0.05f, 0.05f);
+
+	// Small boxes scattered over a 1km cube, the usual open scene
+	Vector<AABB> boxes(count);
+	Vector<i32> proxies(count);
+	BoxList list;
+	list.reserve(count);
+	AABBTree tree(0.1f);
+	for (u32 i = 0; i < count; i++) {
+		Vec3 c(pos(rng), pos(rng), pos(rng)), e(size(rng), size(rng), size(rng));
+		boxes[i] = AABB(c - e, c + e);
+		list.push(c, e);
+		proxies[i] = tree.insert(boxes[i], i);
+	}
+	std::printf("tree height %u\n", tree.height());
+
+	const Vec3 eye(0.0f, 0.0f, 0.0f), dir = glm::normalize(Vec3(1.0f, 0.2f, 0.5f));
+	const Frustum frustum(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f) *
+						  glm::lookAt(eye, eye + dir, Vec3(0.0f, 1.0f, 0.0f)));
+	const Vec3 center(pos(rng), pos(rng), pos(rng));
+	const float radius = 50.0f;
+	const u32 k = 8;
+
+	Vector<u32> visible;
+	Vector<i32> found;
+	u32 hits = 0;
+
+	record(benchRun("frustum/linear", count, iterations, [&]() {
+		visible.clear();
+		frustum.cull(list, visible);
+		benchSink(visible.size());
+	}), count);
+	const u32 linearVisible = visible.size();
+
+	record(benchRun("frustum/tree", count, iterations, [&]() {
+		hits = 0;
+		tree.query(frustum, [&](i32, u64) { hits++; return true; });
+		benchSink(hits);
+	}), count);
+	// The tree tests fat boxes, so it may report a few more
+	if (hits < linearVisible) {
+		std::fprintf(stderr, "Frustum query missed boxes (%u < %u)\n", hits, linearVisible);
+		std::exit(1);
+	}
+
+	record(benchRun("sphere/linear", count, iterations, [&]() {
+		hits = 0;
+		for (const AABB& box : boxes) hits += box.distanceSq(center) <= radius * radius;
+		benchSink(hits);
+	}), count);
+	const u32 linearSphere = hits;
+
+	record(benchRun("sphere/tree", count, iterations, [&]() {
+		hits = 0;
+		tree.query(center, radius, [&](i32, u64) { hits++; return true; });
+		benchSink(hits);
+	}), count);
+	if (hits < linearSphere) {
+		std::fprintf(stderr, "Sphere query missed boxes (%u < %u)\n", hits, linearSphere);
+		std::exit(1);
+	}
+
+	const Vec3 inv = 1.0f / dir;
+	u64 nearestLinear = ~0ull, nearestTree = ~0ull;
+	record(benchRun("raycast/linear", count, iterations, [&]() {
+		float best = 1000.0f, t;
+		for (u32 i = 0; i < count; i++) {
+			if (boxes[i].raycast(eye, inv, best, t) && t < best) {
+				best = t;
+				nearestLinear = i;
+			}
+		}
+		benchSink(best);
+	}), count);
+
+	record(benchRun("raycast/tree", count, iterations, [&]() {
+		tree.raycast(eye, dir, 1000.0f, [&](i32, u64 i, float maxDistance) {
+			float t;
+			if (!boxes[i].raycast(eye, inv, maxDistance, t)) return maxDistance;
+			nearestTree = i;
+			return t;
+		});
+		benchSink(nearestTree);
+	}), count);
+	if (nearestTree != nearestLinear) {
+		std::fprintf(stderr, "Raycast disagrees\n");
+		std::exit(1);
+	}
+
+	Vector<std::pair<float, u32>> sorted(count);
+	record(benchRun("nearest8/linear", count, iterations, [&]() {
+		for (u32 i = 0; i < count; i++) sorted[i] = { boxes[i].distanceSq(center), i };
+		std::partial_sort(sorted.begin(), sorted.begin() + k, sorted.end());
+		benchSink(sorted[0].second);
+	}), count);
+
+	record(benchRun("nearest8/tree", count, iterations, [&]() {
+		tree.nearest(center, k, found);
+		benchSink(found[0]);
+	}), count);
+
+	// Every box nudged a little each frame, most stay inside their fat box
+	record(benchRun("refit/jitter", count, iterations, [&]() {
+		u32 reinserted = 0;
+		for (u32 i = 0; i < count; i++) {
+			Vec3 d(jitter(rng), jitter(rng), jitter(rng));
+			boxes[i] = AABB(boxes[i].min() + d, boxes[i].max() + d);
+			reinserted += tree.move(proxies[i], boxes[i]);
+		}
+		benchSink(reinserted);
+	}), count);
+}
+
+int main(int argc, char** argv) {
+	String jsonPath, csvPath;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "--json") == 0) jsonPath = argv[i + 1];
+		else if (std::strcmp(argv[i], "--csv") == 0) csvPath = argv[i + 1];
+	}
+
+	std::printf("%-48s %10s %15s %15s %18s\n", "benchmark", "items", "avg", "min", "per item");
+	for (u32 count : { 1000u, 10000u, 100000u }) {
+		std::printf("-- %u boxes\n", count);
+		run(count, 50);
+	}
+
+	if (!jsonPath.empty() && !benchWriteJSON(jsonPath, g_results)) {
+		std::fprintf(stderr, "Failed to write %s\n", jsonPath.c_str());
+		return 1;
+	}
+	if (!csvPath.empty() && !benchWriteCSV(csvPath, g_results)) {
+		std::fprintf(stderr, "Failed to write %s\n", csvPath.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include "bench.h"
+
+#include "../src/math/trs.h"
+
+#include <cstring>
+#include <random>
+
+static Vector<BenchResult> g_results;
+
+static void record(BenchResult res, u32 count) {
+	res.entities = count;
+	benchPrint(res);
+	g_results.push_back(res);
+}
+
+static void run(u32 count, u32 iterations) {
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+	Vector<Vec3> positions(count), scales(count);
+	Vector<Quat> rotations(count);
+	TRSBatch batch;
+	batch.reserve(count);
+	for (u32 i = 0; i < count; i++) {
+		positions[i] = Vec3(dist(rng), dist(rng), dist(rng)) * 100.0f;
+		rotations[i] = glm::normalize(Quat(dist(rng), dist(rng), dist(rng), dist(rng)));
+		scales[i] = Vec3(1.0f) + Vec3(dist(rng), dist(rng), dist(rng)) * 0.5f;
+		batch.push(positions[i], rotations[i], scales[i]);
+	}
+	TRSStreams streams = batch.streams();
+
+	Vector<Mat4> local(count), parents(count), world(count);
+	for (u32 i = 0; i < count; i++) {
+		parents[i] = glm::translate(Mat4(1.0f), positions[(i + 1) % count]) * glm::mat4_cast(rotations[(i + 7) % count]);
+	}
+
+	// What Transform::getTransformationLocal() used to do for every entity
+	record(benchRun("compose/glm", count, iterations, [&]() {
+		for (u32 i = 0; i < count; i++) {
+			local[i] = glm::translate(Mat4(1.0f), positions[i]) *
+				glm::mat4_cast(rotations[i]) *
+				glm::scale(Mat4(1.0f), scales[i]);
+		}
+		benchSink(local[count - 1][3][0]);
+	}), count);
+
+	record(benchRun("compose/scalar", count, iterations, [&]() {
+		composeTRSScalar(streams, local.data(), count);
+		benchSink(local[count - 1][3][0]);
+	}), count);
+
+	record(benchRun("compose/simd", count, iterations, [&]() {
+		composeTRS(streams, local.data(), count);
+		benchSink(local[count - 1][3][0]);
+	}), count);
+
+	record(benchRun("parent*local/glm", count, iterations, [&]() {
+		for (u32 i = 0; i < count; i++) {
+			world[i] = parents[i] * local[i];
+		}
+		benchSink(world[count - 1][3][0]);
+	}), count);
+
+	record(benchRun("parent*local/simd", count, iterations, [&]() {
+		multiplyBatch(parents.data(), local.data(), world.data(), count);
+		benchSink(world[count - 1][3][0]);
+	}), count);
+
+	// Both paths have to agree before their timings mean anything
+	Vector<Mat4> expected(count);
+	for (u32 i = 0; i < count; i++) {
+		expected[i] = parents[i] * (glm::translate(Mat4(1.0f), positions[i]) *
+			glm::mat4_cast(rotations[i]) *
+			glm::scale(Mat4(1.0f), scales[i]));
+	}
+	composeTRS(streams, local.data(), count);
+	multiplyBatch(parents.data(), local.data(), world.data(), count);
+	for (u32 i = 0; i < count; i++) {
+		for (u32 c = 0; c < 4; c++) {
+			Vec4 diff = glm::abs(world[i][c] - expected[i][c]);
+			if (std::max(std::max(diff.x, diff.y), std::max(diff.z, diff.w)) > 1e-3f) {
+				std::fprintf(stderr, "Mismatch at transform %u\n", i);
+				std::exit(1);
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	String jsonPath, csvPath;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "--json") == 0) jsonPath = argv[i + 1];
+		else if (std::strcmp(argv[i], "--csv") == 0) csvPath = argv[i + 1];
+	}
+
+#if defined(SIMD_AVX2)
+	std::printf("SIMD path: AVX2\n");
+#elif defined(SIMD_SSE)
+	std::printf("SIMD path: SSE\n");
+#else
+	std::printf("SIMD path: none (scalar)\n");
+#endif
+
+	std::printf("%-48s %10s %15s %15s %18s\n", "benchmark", "items", "avg", "min", "per item");
+	for (u32 count : { 1000u, 10000u, 100000u }) {
+		std::printf("-- %u transforms\n", count);
+		run(count, 50);
+	}
+
+	if (!jsonPath.empty() && !benchWriteJSON(jsonPath, g_results)) {
+		std::fprintf(stderr, "Failed to write %s\n", jsonPath.c_str());
+		return 1;
+	}
+	if (!csvPath.empty() && !benchWriteCSV(csvPath, g_results)) {
+		std::fprintf(stderr, "Failed to write %s\n", csvPath.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include "bench.h"
+
+#include "../src/core/ecs.h"
+
+struct Position : public Component { float x = 0, y = 0, z = 0; };
+struct Velocity : public Component { float x = 1, y = 1, z = 1; };
+struct Health : public Component { float value = 100.0f; };
+
+template <u32 N>
+struct Filler : public Component { u32 value = N; };
+
+// Spreads entities over up to 16 archetypes using unrelated filler components
+static void populate(EntityWorld& world, u32 count, bool fragmented) {
+	for (u32 i = 0; i < count; i++) {
+		Entity& ent = world.create();
+		ent.assign<Position>();
+		if (i % 2 == 0) ent.assign<Velocity>();
+		if (i % 3 == 0) ent.assign<Health>();
+		if (!fragmented) continue;
+		if (i & 1) ent.assign<Filler<0>>();
+		if (i & 2) ent.assign<Filler<1>>();
+		if (i & 4) ent.assign<Filler<2>>();
+		if (i & 8) ent.assign<Filler<3>>();
+	}
+}
+
+static void runCase(u32 count, bool fragmented) {
+	EntityWorld world;
+	populate(world, count, fragmented);
+
+	const char* layout = fragmented ? "fragmented" : "packed";
+	const u32 iterations = 20;
+
+	benchPrint(benchRun(Util::strCat("each<Position, Velocity> ", layout), count, iterations, [&]() {
+		float acc = 0.0f;
+		world.each([&](Entity& ent, Position& p, Velocity& v) {
+			p.x += v.x; acc += p.x;
+		});
+		benchSink(acc);
+	}));
+
+	View<Position, Velocity>& view = world.view<Position, Velocity>();
+	benchPrint(benchRun(Util::strCat("view<Position, Velocity> ", layout), count, iterations, [&]() {
+		float acc = 0.0f;
+		view.each([&](Entity& ent, Position& p, Velocity& v) {
+			p.x += v.x; acc += p.x;
+		});
+		benchSink(acc);
+	}));
+
+	// Queries issued several times per frame for tiny sets (e.g. lights) are dominated by lookup
+	benchPrint(benchRun(Util::strCat("each<Health> (100 queries) ", layout), count * 100, iterations, [&]() {
+		float acc = 0.0f;
+		for (u32 i = 0; i < 100; i++) {
+			world.each([&](Entity& ent, Health& h) { acc += h.value; });
+		}
+		benchSink(acc);
+	}));
+
+	benchPrint(benchRun(Util::strCat("view<Health> (100 queries) ", layout), count * 100, iterations, [&]() {
+		float acc = 0.0f;
+		for (u32 i = 0; i < 100; i++) {
+			world.view<Health>().each([&](Entity& ent, Health& h) { acc += h.value; });
+		}
+		benchSink(acc);
+	}));
+}
+
+int main(int argc, char** argv) {
+	std::printf("%-48s %10s %15s %15s %18s\n", "benchmark", "entities", "avg", "min", "per item");
+	for (u32 count : { 1000u, 10000u, 100000u }) {
+		runCase(count, false);
+		runCase(count, true);
+	}
+	return 0;
+}
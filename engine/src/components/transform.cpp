@@ -4,90 +4,62 @@ NS_BEGIN
 
 Transform::Transform()
 	:	position(Vec3()), scale(Vec3(1.0f)), rotation(Quat(0, 0, 0, 1.0f)),
-		m_prevPosition(Vec3()), m_prevScale(Vec3(1.0f)), m_prevRotation(Quat(0, 0, 0, 1.0f)),
-		m_parentMatrix(Mat4(1.0f)), m_dirty(false), m_parent(nullptr)
+		m_parent(ECS_INVALID_ENTITY), m_world(Mat4(1.0f)),
+		m_pose({ Vec3(0.0f), Vec3(1.0f), Quat(1.0f, 0, 0, 0) }), m_prevPose(m_pose),
+		m_moving(false), m_snap(true), m_node(~0u)
 {}
 
-bool Transform::changed() {
-	if (m_parent && m_parent->changed()) {
-		return true;
-	}
-
-	if (position.x != m_prevPosition.x ||
-		position.y != m_prevPosition.y ||
-		position.z != m_prevPosition.z) {
-		m_prevPosition = position;
-		return true;
-	}
-
-	if (scale.x != m_prevScale.x ||
-		scale.y != m_prevScale.y ||
-		scale.z != m_prevScale.z) {
-		m_prevScale = scale;
-		return true;
-	}
+static void decompose(const Mat4& m, Vec3& position, Quat& rotation, Vec3& scale) {
+	position = Vec3(m[3]);
+	scale = Vec3(glm::length(Vec3(m[0])), glm::length(Vec3(m[1])), glm::length(Vec3(m[2])));
+	rotation = glm::quat_cast(Mat3(Vec3(m[0]) / scale.x, Vec3(m[1]) / scale.y, Vec3(m[2]) / scale.z));
+}
 
-	if (rotation.x != m_prevRotation.x ||
-		rotation.y != m_prevRotation.y ||
-		rotation.z != m_prevRotation.z ||
-		rotation.w != m_prevRotation.w)
-	{
-		m_prevRotation = rotation;
-		return true;
-	}
+void Transform::setWorld(const Mat4& world) {
+	Pose pose;
+	decompose(world, pose.position, pose.rotation, pose.scale);
 
-	return false;
+	m_world = world;
+	m_prevPose = m_snap ? pose : m_pose;
+	m_pose = pose;
+	m_moving = !m_snap;
+	m_snap = false;
 }
 
-void Transform::update() {
-	if(m_dirty) {
-		m_prevPosition = position;
-		m_prevRotation = rotation;
-		m_prevScale = scale;
-	} else {
-		m_prevPosition = position + Vec3(1.0f);
-		m_prevRotation = rotation * 0.5f;
-		m_prevScale = scale + Vec3(1.0f);
-		m_dirty = true;
+Mat4 Transform::getTransformation(float alpha) const {
+	if (!m_moving || alpha >= 1.0f) {
+		return m_world;
 	}
-}
 
-void Transform::setParent(Transform* parent) {
-	m_parent = parent;
+	Vec3 scale = glm::mix(m_prevPose.scale, m_pose.scale, alpha);
+	Mat4 m = glm::mat4_cast(glm::slerp(m_prevPose.rotation, m_pose.rotation, alpha));
+	m[0] *= scale.x;
+	m[1] *= scale.y;
+	m[2] *= scale.z;
+	m[3] = Vec4(glm::mix(m_prevPose.position, m_pose.position, alpha), 1.0f);
+	return m;
 }
 
-Quat Transform::worldRotation() {
-	Quat parentRotation(1, 0, 0, 0);
-
-	if (m_parent) {
-		parentRotation = m_parent->worldRotation();
+Quat Transform::worldRotation(float alpha) const {
+	if (!m_moving || alpha >= 1.0f) {
+		return m_pose.rotation;
 	}
-
-	return parentRotation * rotation;
+	return glm::slerp(m_prevPose.rotation, m_pose.rotation, alpha);
 }
 
-Mat4 Transform::getTransformation() {
-	update();
-	return getParentTransform() *
-			glm::translate(Mat4(1.0f), position) *
-			glm::mat4_cast(rotation) *
-			glm::scale(Mat4(1.0f), scale);
+Vec3 Transform::worldPosition(float alpha) const {
+	if (!m_moving || alpha >= 1.0f) {
+		return m_pose.position;
+	}
+	return glm::mix(m_prevPose.position, m_pose.position, alpha);
 }
 
-Mat4 Transform::getTransformationLocal() {
-	update();
+Mat4 Transform::getTransformationLocal() const {
 	return glm::translate(Mat4(1.0f), position) *
 			glm::mat4_cast(rotation) *
 			glm::scale(Mat4(1.0f), scale);
 }
 
-Mat4 Transform::getParentTransform() {
-	if (m_parent && m_parent->changed()) {
-		m_parentMatrix = m_parent->getTransformation();
-	}
-	return m_parentMatrix;
-}
-
 bool Transform::moveTowards(const Vec3& target, float mdd) {
 	Vec3 a = target - position;
 	float l = glm::length(a);
@@ -9,32 +9,42 @@
 
 NS_BEGIN
 
+/// Local position/rotation/scale plus a parent entity. The world matrix is cached,
+/// TransformSystem refreshes it once per frame for the whole hierarchy. Edit it through
+/// Entity::modify<Transform>(), the refresh only looks at Transforms flagged as changed.
 class Transform : public Component {
+	friend class TransformSystem;
 public:
 	Transform();
 
 	Vec3 position, scale;
 	Quat rotation;
 
-	Transform* parent() { return m_parent; }
-	void setParent(Transform* parent);
+	/// Id of the parent entity, ECS_INVALID_ENTITY for roots.
+	u64 parent() const { return m_parent; }
+	void setParent(u64 parent) { m_parent = parent; }
+	void setParent(const Entity* parent) { m_parent = parent ? parent->id() : ECS_INVALID_ENTITY; }
 
 	void rotate(const Quat& rot);
 	void rotate(const Vec3& axis, float angle);
 	void lookAt(const Vec3& eye, const Vec3& at, const Vec3& up);
 
-	bool changed();
+	Vec3 worldPosition() const { return m_pose.position; }
+	Quat worldRotation() const { return m_pose.rotation; }
 
-	Vec3 worldPosition() { return Vec3((getParentTransform() * Vec4(position, 1.0f))); }
-	Quat worldRotation();
+	Vec3 forward() const { return Vec3(worldRotation() * Vec4(0, 0, -1, 0)); }
+	Vec3 forward(float alpha) const { return Vec3(worldRotation(alpha) * Vec4(0, 0, -1, 0)); }
+	Vec3 right() const { return Vec3(worldRotation() * Vec4(1, 0, 0, 0)); }
+	Vec3 up() const { return Vec3(worldRotation() * Vec4(0, 1, 0, 0)); }
 
-	Vec3 forward() { return Vec3(worldRotation() * Vec4(0, 0, -1, 0)); }
-	Vec3 right() { return Vec3(worldRotation() * Vec4(1, 0, 0, 0)); }
-	Vec3 up() { return Vec3(worldRotation() * Vec4(0, 1, 0, 0)); }
+	/// World matrix as of the last TransformSystem::refresh().
+	const Mat4& getTransformation() const { return m_world; }
 
-	Mat4 getTransformation();
-	Mat4 getTransformationLocal();
-	Mat4 getParentTransform();
+	/// World matrix blended between the two last refreshes, for rendering between fixed updates.
+	Mat4 getTransformation(float alpha) const;
+	Vec3 worldPosition(float alpha) const;
+	Quat worldRotation(float alpha) const;
+	Mat4 getTransformationLocal() const;
 
 	// Utilities
 	bool moveTowards(const Vec3& target, float mdd);
@@ -42,16 +52,24 @@ public:
 	void setFromMatrix(const Mat4& mat);
 
 private:
-	Transform* m_parent;
+	/// World matrix split in its parts once per refresh, blending between refreshes reads these.
+	struct Pose {
+		Vec3 position, scale;
+		Quat rotation;
+	};
 
-	Vec3 m_prevPosition, m_prevScale;
-	Quat m_prevRotation;
+	u64 m_parent;
+	Mat4 m_world;
+	Pose m_pose, m_prevPose;
 
-	Mat4 m_parentMatrix;
+	// m_moving: the world matrix changed in the last refresh, m_snap: skip the blend on the next one
+	bool m_moving, m_snap;
 
-	bool m_dirty;
+	// Slot in the TransformSystem arrays
+	u32 m_node;
 
-	void update();
+	/// Takes the new world matrix from TransformSystem, the current pose becomes the previous one.
+	void setWorld(const Mat4& world);
 };
 
 NS_END
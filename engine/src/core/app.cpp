@@ -69,7 +69,9 @@ Application::Application(IApplicationAdapter* adapter, ApplicationConfig config)
 	m_applicationAdapter = uptr<IApplicationAdapter>(mov(adapter));
 	m_config = config;
 
-	MessageSystem::get().subscribe(this);
+	MessageSystem::get().subscribe<AppQuitMessage>(this, [this](const AppQuitMessage&) {
+		m_running = false;
+	});
 }
 
 void Application::run() {
@@ -173,12 +175,6 @@ void Application::run() {
 	LogInfo("Application Finished.");
 }
 
-void Application::processMessage(const Message& msg) {
-	if (msg.type == "app_quit") {
-		m_running = false;
-	}
-}
-
 void Application::eng_mainloop() {
 	const double timeStep = 1.0 / double(m_config.frameCap);
 	double startTime = Util::getTime();
@@ -186,6 +182,7 @@ void Application::eng_mainloop() {
 
 	m_applicationAdapter->init();
 
+	bool simulated = false;
 	while (m_running) {
 		bool canRender = false;
 		double currentTime = Util::getTime();
@@ -203,8 +200,7 @@ void Application::eng_mainloop() {
 					evt.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
 				{
 					if (m_config.notifyResize) {
-						Vec2 *sz = new Vec2(evt.window.data1, evt.window.data2);
-						MessageSystem::get().submit("app_window_resized", sz);
+						MessageSystem::get().post(WindowResizedMessage{ u32(evt.window.data1), u32(evt.window.data2) });
 					}
 					if (m_applicationAdapter)
 						m_applicationAdapter->windowResized(evt.window.data1, evt.window.data2);
@@ -215,14 +211,16 @@ void Application::eng_mainloop() {
 			MessageSystem::get().processQueue(float(timeStep));
 
 			canRender = true;
+			simulated = true;
 		}
 
-		if (canRender) {
+		// Nothing is worth drawing before the first update
+		if (canRender || (m_config.uncappedRender && simulated)) {
 			ImGuiSystem::NewFrame();
 			ImGuizmo::BeginFrame();
 
 			if (m_applicationAdapter)
-				m_applicationAdapter->render();
+				m_applicationAdapter->render(float(accum / timeStep));
 
 			if (m_applicationAdapter)
 				m_applicationAdapter->gui();
@@ -17,19 +17,32 @@ struct ApplicationConfig {
 	String title;
 	i32 frameCap;
 	bool notifyResize, maximized;
+
+	/// Render on every loop iteration instead of only after an update. The simulation still
+	/// runs at 'frameCap' steps per second, render() gets the alpha to interpolate with.
+	bool uncappedRender;
 	SDL_Window *window;
 
 	ApplicationConfig()
 		: width(640), height(480), fullScreen(false), title("Engine"),
-		  frameCap(60), notifyResize(true), maximized(false), window(nullptr)
+		  frameCap(60), notifyResize(true), maximized(false), uncappedRender(true), window(nullptr)
 	{}
 };
 
+/// Posted to stop the main loop.
+struct AppQuitMessage {};
+
+/// Posted when the window size changes (if ApplicationConfig::notifyResize is set).
+struct WindowResizedMessage {
+	u32 width, height;
+};
+
 class IApplicationAdapter {
 public:
 	virtual void init() = 0;
 	virtual void update(float timeDelta) = 0;
-	virtual void render() = 0;
+	/// 'alpha' is how far (0 to 1) real time is past the last update, towards the next one.
+	virtual void render(float alpha) = 0;
 	virtual void gui() {}
 	virtual void windowResized(u32 width, u32 height) {}
 	virtual void applicationExited() {}
@@ -39,15 +52,13 @@ public:
 	ApplicationConfig config;
 };
 
-class Application final : public IObject {
+class Application final {
 public:
 	Application() = default;
 	Application(IApplicationAdapter* adapter, ApplicationConfig config = ApplicationConfig());
 
 	void run();
 
-	void processMessage(const Message& msg);
-
 	ApplicationConfig config() const { return m_config; }
 
 	Application(const Application&) = delete;
@@ -1,66 +1,586 @@
 #include "ecs.h"
 
 #include <algorithm>
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
 
 NS_BEGIN
 
-void EntityWorld::processMessage(const Message& msg) {
-	for (uptr<EntitySystem>& sys : m_systems) {
-		sys->messageReceived(*this, msg);
+static void removeFromList(EntityList& list, Entity* ent) {
+	auto found = std::find(list.begin(), list.end(), ent);
+	if (found != list.end()) {
+		*found = list.back();
+		list.pop_back();
+	}
+}
+
+EntityWorld::EntityWorld() {
+	createArchetype(ComponentMask());
+	m_ownerThread = std::this_thread::get_id();
+
+	u32 threads = JobSystem::get().threadCount();
+	for (u32 i = 0; i < threads; i++) {
+		m_commandBuffers.push_back(uptr<CommandBuffer>(new CommandBuffer()));
 	}
 }
 
 Entity& EntityWorld::create(const String& name) {
-	m_entities.push_back(uptr<Entity>(new Entity()));
-	m_entities.back()->m_id = m_entities.size();
-	m_entities.back()->setName(name);
-	m_recentlyCreated.push_back(m_entities.back().get());
-	return *m_entities.back().get();
+	return createIn(rootArchetype(), name);
+}
+
+Entity& EntityWorld::createIn(Archetype* arch, const String& name) {
+	assert(m_iterating == 0 && "Structural change while iterating, record it through commands().");
+	u32 index;
+	if (!m_freeSlots.empty()) {
+		index = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	} else {
+		index = m_slots.size();
+		m_slots.push_back({ uptr<Entity>(new Entity(this)), 1, false });
+	}
+
+	// Slots keep their Entity object around, so recycling one doesn't allocate
+	EntitySlot& slot = m_slots[index];
+	slot.alive = true;
+
+	Entity* ent = slot.entity.get();
+	ent->m_id = makeEntityID(index, slot.generation);
+	ent->setName(name);
+
+	ent->m_archetype = arch;
+	ent->m_row = arch->m_entities.size();
+	arch->m_entities.push_back(ent);
+
+	ent->m_listIndex = m_entities.size();
+	m_entities.push_back(ent);
+
+	ent->m_announced = false;
+	m_recentlyCreated.push_back(ent->m_id);
+	return *ent;
 }
 
 void EntityWorld::destroy(Entity& entity) {
-	if (entity.id() == ECS_INVALID_ENTITY || entity.id() > m_entities.size()) {
+	if (entity.m_world != this || !alive(entity.id())) {
 		return;
 	}
-	m_recentlyDestroyed.push_back(&entity);
-	m_entities.erase(m_entities.begin() + (entity.id() - 1));
-}
 
-void EntityWorld::update(float dt) {
-	for (Entity* ent : m_recentlyCreated) {
+	// Systems never heard of entities that die before the next update()
+	if (entity.m_announced) {
 		for (uptr<EntitySystem>& sys : m_systems) {
-			sys->entityCreated(*this, *ent);
+			if (sys->watching(entity.mask())) {
+				sys->entityDestroyed(*this, entity);
+			}
+		}
+	}
+	destroyEntity(entity);
+}
+
+void EntityWorld::destroyEntity(Entity& entity) {
+	assert(m_iterating == 0 && "Structural change while iterating, record it through commands().");
+	// Dead entities point at the (column-less) root archetype so has/get stay safe
+	removeRow(entity.m_archetype, entity.m_row);
+	entity.m_archetype = rootArchetype();
+
+	Entity* last = m_entities.back();
+	m_entities[entity.m_listIndex] = last;
+	last->m_listIndex = entity.m_listIndex;
+	m_entities.pop_back();
+
+	u32 index = entity.index();
+	EntitySlot& slot = m_slots[index];
+	slot.alive = false;
+	slot.generation++;
+	if (slot.generation == 0) {
+		slot.generation = 1;
+	}
+	unindexName(entity);
+	for (Tag tag : entity.m_tags) {
+		removeFromList(m_tagged[tag], &entity);
+	}
+	entity.m_tags.clear();
+
+	entity.m_id = ECS_INVALID_ENTITY;
+	entity.m_name.clear();
+	m_freeSlots.push_back(index);
+}
+
+Entity* EntityWorld::findByName(const String& name) {
+	auto found = m_nameIndex.find(name);
+	return found == m_nameIndex.end() || found->second.empty() ? nullptr : found->second.front();
+}
+
+const EntityList& EntityWorld::findAllByName(const String& name) {
+	static const EntityList empty;
+	auto found = m_nameIndex.find(name);
+	return found == m_nameIndex.end() ? empty : found->second;
+}
+
+void EntityWorld::indexName(Entity& ent) {
+	if (!ent.m_name.empty()) {
+		m_nameIndex[ent.m_name].push_back(&ent);
+	}
+}
+
+void EntityWorld::unindexName(Entity& ent) {
+	auto found = m_nameIndex.find(ent.m_name);
+	if (found == m_nameIndex.end()) return;
+
+	removeFromList(found->second, &ent);
+	if (found->second.empty()) {
+		m_nameIndex.erase(found);
+	}
+}
+
+Tag EntityWorld::tag(const String& name) {
+	auto found = m_tagIDs.find(name);
+	if (found != m_tagIDs.end()) {
+		return found->second;
+	}
+
+	Tag tag = m_tagged.size();
+	m_tagIDs[name] = tag;
+	m_tagged.push_back(EntityList());
+	return tag;
+}
+
+const EntityList& EntityWorld::tagged(const String& tag) {
+	return tagged(this->tag(tag));
+}
+
+const EntityList& EntityWorld::tagged(Tag tag) {
+	return m_tagged[tag];
+}
+
+void EntityWorld::destroy(u64 id) {
+	Entity* ent = getEntity(id);
+	if (ent) {
+		destroy(*ent);
+	}
+}
+
+CommandBuffer& EntityWorld::commands() {
+	u32 index = JobSystem::get().threadIndex();
+	if (index == 0 && std::this_thread::get_id() != m_ownerThread) {
+		return m_sharedCommands;
+	}
+	return *m_commandBuffers[index];
+}
+
+void EntityWorld::playbackCommands() {
+	Vector<u64> destroyed;
+
+	// Handlers called while applying commands or announcing the new entities may record
+	// more, in any buffer. Those are played back here too.
+	bool recorded = true;
+	while (recorded) {
+		recorded = false;
+		for (uptr<CommandBuffer>& cmds : m_commandBuffers) {
+			recorded |= playback(*cmds, destroyed);
+		}
+		{
+			// Other threads wait until it's played back and cleared
+			CommandBuffer::Guard guard(m_sharedCommands);
+			recorded |= playback(m_sharedCommands, destroyed);
+		}
+		announceCreated();
+	}
+
+	if (destroyed.empty()) return;
+
+	EntityList dying;
+	for (u64 id : destroyed) {
+		Entity* ent = getEntity(id);
+		if (!ent || std::find(dying.begin(), dying.end(), ent) != dying.end()) continue;
+
+		// Created by a notification handler above, the systems haven't seen it yet
+		if (!ent->m_announced) {
+			destroyEntity(*ent);
+			continue;
 		}
+		dying.push_back(ent);
 	}
+	notifyDestroyed(dying);
+	for (Entity* ent : dying) {
+		destroyEntity(*ent);
+	}
+}
+
+bool EntityWorld::playback(CommandBuffer& cmds, Vector<u64>& destroyed) {
+	bool any = false;
+	while (!cmds.m_commands.empty()) {
+		// Taken out first: applying a command can run entityCreated() handlers, which may record
+		// into this very buffer. What they record (with fresh pending indices) is the next batch.
+		Vector<CommandBuffer::Command> batch = mov(cmds.m_commands);
+		cmds.clear();
+		any = true;
+
+		Vector<u64> created;
+		for (CommandBuffer::Command& cmd : batch) {
+			switch (cmd.type) {
+				case CommandBuffer::Command::Create:
+					created.push_back(create(cmd.name).id());
+					break;
+				case CommandBuffer::Command::Destroy:
+					destroyed.push_back(cmd.target);
+					break;
+				case CommandBuffer::Command::Apply: {
+					Entity* ent = getEntity(cmd.pending ? created[cmd.target] : cmd.target);
+					if (ent) {
+						cmd.apply(*ent);
+					}
+				} break;
+			}
+		}
+	}
+	return any;
+}
+
+void EntityWorld::announceCreated() {
+	if (m_recentlyCreated.empty()) return;
+
+	// Swapped out first, the systems may create more entities while handling these
+	Vector<u64> ids = mov(m_recentlyCreated);
 	m_recentlyCreated.clear();
 
-	for (Entity* ent : m_recentlyDestroyed) {
-		for (uptr<EntitySystem>& sys : m_systems) {
-			sys->entityDestroyed(*this, *ent);
+	EntityList created;
+	created.reserve(ids.size());
+	for (u64 id : ids) {
+		Entity* ent = getEntity(id);
+		if (ent) {
+			ent->m_announced = true;
+			created.push_back(ent);
+		}
+	}
+	notifyCreated(created);
+}
+
+void EntityWorld::notifyCreated(const EntityList& ents) {
+	if (ents.empty()) return;
+
+	EntityList matching;
+	for (uptr<EntitySystem>& sys : m_systems) {
+		if (sys->watchMask().none()) {
+			sys->entitiesCreated(*this, ents);
+			continue;
+		}
+
+		matching.clear();
+		for (Entity* ent : ents) {
+			if (sys->watching(ent->mask())) matching.push_back(ent);
+		}
+		if (!matching.empty()) {
+			sys->entitiesCreated(*this, matching);
+		}
+	}
+}
+
+void EntityWorld::notifyDestroyed(const EntityList& ents) {
+	if (ents.empty()) return;
+
+	EntityList matching;
+	for (uptr<EntitySystem>& sys : m_systems) {
+		if (sys->watchMask().none()) {
+			sys->entitiesDestroyed(*this, ents);
+			continue;
+		}
+
+		matching.clear();
+		for (Entity* ent : ents) {
+			if (sys->watching(ent->mask())) matching.push_back(ent);
+		}
+		if (!matching.empty()) {
+			sys->entitiesDestroyed(*this, matching);
+		}
+	}
+}
+
+void EntityWorld::signatureEntered(Entity& ent, const ComponentMask& before) {
+	if (!ent.m_announced) return;
+
+	for (uptr<EntitySystem>& sys : m_systems) {
+		if (sys->watchMask().any() && sys->watching(ent.mask()) && !sys->watching(before)) {
+			sys->entityCreated(*this, ent);
 		}
 	}
-	m_recentlyDestroyed.clear();
+}
+
+void EntityWorld::signatureLeaving(Entity& ent, const ComponentMask& after) {
+	if (!ent.m_announced) return;
 
 	for (uptr<EntitySystem>& sys : m_systems) {
-		sys->update(*this, dt);
+		if (sys->watchMask().any() && sys->watching(ent.mask()) && !sys->watching(after)) {
+			sys->entityDestroyed(*this, ent);
+		}
+	}
+}
+
+void EntityWorld::update(float dt) {
+	playbackCommands();
+
+	if (m_scheduleDirty) {
+		buildSchedule();
+	}
+	for (const SystemStage& stage : m_schedule) {
+		runStage(stage, dt);
+		playbackCommands();
+		m_changeTick++;
+	}
+}
+
+void EntityWorld::buildSchedule() {
+	m_schedule.clear();
+
+	for (u32 i = 0; i < m_systems.size(); i++) {
+		EntitySystem* sys = m_systems[i].get();
+		if (!sys->declaresAccess()) {
+			SystemStage stage;
+			stage.exclusive = true;
+			stage.systems.push_back(i);
+			m_schedule.push_back(stage);
+			continue;
+		}
+
+		if (m_schedule.empty() || m_schedule.back().exclusive) {
+			SystemStage stage;
+			stage.exclusive = false;
+			m_schedule.push_back(stage);
+		}
+
+		// Registration order only matters between systems whose access overlaps
+		SystemStage& stage = m_schedule.back();
+		u32 node = stage.systems.size();
+		u32 deps = 0;
+		for (u32 j = 0; j < node; j++) {
+			if (m_systems[stage.systems[j]]->conflictsWith(*sys)) {
+				stage.dependents[j].push_back(node);
+				deps++;
+			}
+		}
+		stage.systems.push_back(i);
+		stage.dependents.push_back(Vector<u32>());
+		stage.dependencyCount.push_back(deps);
+	}
+
+	m_scheduleDirty = false;
+}
+
+void EntityWorld::runStage(const SystemStage& stage, float dt) {
+	if (stage.exclusive || stage.systems.size() == 1) {
+		for (u32 i : stage.systems) {
+			m_systems[i]->update(*this, dt);
+			m_systems[i]->m_lastRun = m_changeTick;
+		}
+		return;
+	}
+
+	JobSystem& jobs = JobSystem::get();
+	JobGroup group;
+
+	uptr<std::atomic<u32>[]> remaining(new std::atomic<u32>[stage.systems.size()]);
+	for (u32 i = 0; i < stage.systems.size(); i++) {
+		remaining[i] = stage.dependencyCount[i];
+	}
+
+	Fn<void(u32)> launch = [&](u32 node) {
+		jobs.run(group, [&, node]() {
+			EntitySystem* sys = m_systems[stage.systems[node]].get();
+			sys->update(*this, dt);
+			sys->m_lastRun = m_changeTick;
+			for (u32 next : stage.dependents[node]) {
+				if (remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					launch(next);
+				}
+			}
+		});
+	};
+
+	for (u32 i = 0; i < stage.systems.size(); i++) {
+		if (stage.dependencyCount[i] == 0) {
+			launch(i);
+		}
 	}
+	jobs.wait(group);
 }
 
-void EntityWorld::render(FrameBuffer* target, Entity* pov) {
+void EntityWorld::render(FrameBuffer* target, Entity* pov, float alpha) {
+	m_renderAlpha = alpha;
 	for (uptr<EntitySystem>& sys : m_systems) {
 		sys->render(*this, target, pov);
 	}
 }
 
+bool EntityWorld::alive(u64 id) const {
+	u32 index = entityIndex(id);
+	if (index >= m_slots.size()) {
+		return false;
+	}
+	const EntitySlot& slot = m_slots[index];
+	return slot.alive && slot.generation == entityGeneration(id);
+}
+
 Entity* EntityWorld::getEntity(u64 id) {
-	for (uptr<Entity>& ent : m_entities) {
-		if (ent->id() == id) return ent.get();
+	return alive(id) ? m_slots[entityIndex(id)].entity.get() : nullptr;
+}
+
+Entity* EntityWorld::entityAt(u32 index) {
+	if (index >= m_slots.size() || !m_slots[index].alive) {
+		return nullptr;
+	}
+	return m_slots[index].entity.get();
+}
+
+Archetype* EntityWorld::createArchetype(const ComponentMask& mask) {
+	m_archetypes.push_back(uptr<Archetype>(new Archetype()));
+	Archetype* arch = m_archetypes.back().get();
+	arch->m_mask = mask;
+	for (ComponentID id = 0; id < ECS_MAX_COMPONENTS; id++) {
+		if (mask.test(id)) {
+			arch->m_signature.push_back(id);
+		}
+	}
+	m_archetypeIndex[mask] = arch;
+	for (ComponentID id : arch->m_signature) {
+		m_componentArchetypes[id].push_back(arch);
+	}
+
+	for (auto& [key, view] : m_views) {
+		view->archetypeCreated(arch);
+	}
+	return arch;
+}
+
+void Archetype::addColumn(uptr<ComponentArrayBase> col) {
+	m_columnIndex[col->id()] = col.get();
+	m_columns.push_back(mov(col));
+}
+
+Archetype* EntityWorld::archetypeAdd(Archetype* src, ComponentID id, ColumnFactory factory) {
+	if (src->m_addEdges[id]) {
+		return src->m_addEdges[id];
+	}
+
+	ComponentMask mask = src->m_mask;
+	mask.set(id);
+
+	Archetype* arch = nullptr;
+	auto found = m_archetypeIndex.find(mask);
+	if (found != m_archetypeIndex.end()) {
+		arch = found->second;
+	} else {
+		arch = createArchetype(mask);
+		for (uptr<ComponentArrayBase>& col : src->m_columns) {
+			arch->addColumn(col->createEmpty());
+		}
+		arch->addColumn(factory(*this));
+	}
+
+	src->m_addEdges[id] = arch;
+	arch->m_removeEdges[id] = src;
+	return arch;
+}
+
+Archetype* EntityWorld::archetypeRemove(Archetype* src, ComponentID id) {
+	if (src->m_removeEdges[id]) {
+		return src->m_removeEdges[id];
+	}
+
+	ComponentMask mask = src->m_mask;
+	mask.reset(id);
+
+	Archetype* arch = nullptr;
+	auto found = m_archetypeIndex.find(mask);
+	if (found != m_archetypeIndex.end()) {
+		arch = found->second;
+	} else {
+		arch = createArchetype(mask);
+		for (uptr<ComponentArrayBase>& col : src->m_columns) {
+			if (col->id() == id) continue;
+			arch->addColumn(col->createEmpty());
+		}
+	}
+
+	src->m_removeEdges[id] = arch;
+	arch->m_addEdges[id] = src;
+	return arch;
+}
+
+static String demangle(const char* name) {
+#if defined(__GNUC__)
+	int status = 0;
+	char* readable = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+	if (status == 0 && readable) {
+		String ret(readable);
+		std::free(readable);
+		return ret;
+	}
+#endif
+	return name;
+}
+
+Vector<ComponentPoolStats> EntityWorld::poolStats() const {
+	Vector<ComponentPoolStats> ret;
+	for (const uptr<ComponentPoolBase>& pool : m_pools) {
+		if (pool) {
+			ComponentPoolStats stats = pool->stats();
+			const uptr<ComponentSerializer>& ser = m_serializers[stats.id];
+			stats.name = ser ? ser->name : demangle(stats.type.name());
+			ret.push_back(mov(stats));
+		}
+	}
+	return ret;
+}
+
+void EntityWorld::moveEntity(Entity& ent, Archetype* dest) {
+	Archetype* src = ent.m_archetype;
+	if (src == dest) return;
+
+	u32 row = ent.m_row;
+	for (uptr<ComponentArrayBase>& col : src->m_columns) {
+		ComponentArrayBase* destCol = dest->column(col->id());
+		if (destCol) {
+			col->moveTo(row, *destCol);
+		}
+	}
+	removeRow(src, row);
+
+	ent.m_archetype = dest;
+	ent.m_row = dest->m_entities.size();
+	dest->m_entities.push_back(&ent);
+}
+
+void EntityWorld::removeRow(Archetype* arch, u32 row) {
+	for (uptr<ComponentArrayBase>& col : arch->m_columns) {
+		col->swapRemove(row);
+	}
+
+	Entity* last = arch->m_entities.back();
+	arch->m_entities[row] = last;
+	arch->m_entities.pop_back();
+	last->m_row = row;
+}
+
+bool EntitySystem::conflictsWith(const EntitySystem& other) const {
+	if (!m_declaresAccess || !other.m_declaresAccess) {
+		return true;
 	}
-	return nullptr;
+	return (m_writes & (other.m_writes | other.m_reads)).any() ||
+			(m_reads & other.m_writes).any();
 }
 
 void Entity::removeAll() {
-	m_components.clear();
+	Archetype* root = m_world->rootArchetype();
+	m_world->signatureLeaving(*this, root->mask());
+	m_world->moveEntity(*this, root);
+}
+
+ComponentList Entity::components() {
+	ComponentList ret;
+	for (const uptr<ComponentArrayBase>& col : m_archetype->columns()) {
+		ret.push_back(std::make_pair(col->type(), col->get(m_row)));
+	}
+	return ret;
 }
 
 String Entity::name() const {
@@ -68,7 +588,34 @@ String Entity::name() const {
 }
 
 void Entity::setName(const String& name) {
+	bool indexed = m_world->alive(m_id);
+	if (indexed) m_world->unindexName(*this);
 	m_name = name;
+	if (indexed) m_world->indexName(*this);
+}
+
+void Entity::addTag(const String& tag) {
+	assert(m_world->alive(m_id) && "Can't tag a destroyed entity.");
+	Tag t = m_world->tag(tag);
+	if (std::find(m_tags.begin(), m_tags.end(), t) != m_tags.end()) return;
+
+	m_tags.push_back(t);
+	m_world->m_tagged[t].push_back(this);
+}
+
+void Entity::removeTag(const String& tag) {
+	Tag t = m_world->tag(tag);
+	auto found = std::find(m_tags.begin(), m_tags.end(), t);
+	if (found == m_tags.end()) return;
+
+	m_tags.erase(found);
+	removeFromList(m_world->m_tagged[t], this);
+}
+
+bool Entity::hasTag(const String& tag) const {
+	auto found = m_world->m_tagIDs.find(tag);
+	return found != m_world->m_tagIDs.end() &&
+			std::find(m_tags.begin(), m_tags.end(), found->second) != m_tags.end();
 }
 
 NS_END
@@ -3,6 +3,8 @@
 
 #include "../core/types.h"
 #include "../core/msg.h"
+#include "../core/jobs.h"
+#include "../core/snapshot.h"
 #include "../gfx/framebuffer.h"
 
 #include <memory>
@@ -11,53 +13,499 @@
 #include <type_traits>
 #include <cassert>
 #include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <new>
+#include <mutex>
+#include <thread>
 
 #define ECS_INVALID_ENTITY 0
+#define ECS_PARALLEL_MIN_CHUNK 64
+#define ECS_MAX_COMPONENTS 128
+#define ECS_POOL_MIN_BLOCK 16
+#define ECS_POOL_SIZE_CLASSES 24
 
 NS_BEGIN
 
+/// Entity ids pack the storage slot index (low 32 bits) and the slot generation (high 32 bits).
+/// Generations start at 1, so a valid id is never ECS_INVALID_ENTITY.
+inline u64 makeEntityID(u32 index, u32 generation) {
+	return (u64(generation) << 32) | u64(index);
+}
+
+inline u32 entityIndex(u64 id) { return u32(id & 0xFFFFFFFFu); }
+inline u32 entityGeneration(u64 id) { return u32(id >> 32); }
+
 typedef std::type_index TypeIndex;
 template<typename T>
 static TypeIndex getTypeIndex() {
 	return std::type_index(typeid(T));
 }
 
+/// Dense, process-wide component type ids (0, 1, 2...), handed out on first use of each type.
+using ComponentID = u32;
+using ComponentMask = std::bitset<ECS_MAX_COMPONENTS>;
+
+/// Interned tag name, see EntityWorld::tag().
+using Tag = u32;
+
+inline ComponentID nextComponentID() {
+	static std::atomic<ComponentID> counter(0);
+	ComponentID id = counter.fetch_add(1);
+	assert(id < ECS_MAX_COMPONENTS && "Too many component types, raise ECS_MAX_COMPONENTS.");
+	return id;
+}
+
+template <class C>
+ComponentID getComponentID() {
+	static const ComponentID id = nextComponentID();
+	return id;
+}
+
+template <class... Cs>
+const ComponentMask& getComponentMask() {
+	static const ComponentMask mask = []() {
+		ComponentMask m;
+		(m.set(getComponentID<Cs>()), ...);
+		return m;
+	}();
+	return mask;
+}
+
 struct Component {
 	virtual ~Component() = default;
 };
 
-using ComponentMap = UMap<TypeIndex, uptr<Component>>;
+/// Type-erased column holding every component of one type inside an Archetype.
+/// Each row also carries the world change tick at which its component was last changed.
+class ComponentArrayBase {
+public:
+	explicit ComponentArrayBase(const u32* tick) : m_tick(tick) {}
+	virtual ~ComponentArrayBase() = default;
 
-class Entity {
+	u32 version(u32 row) const { return m_versions[row]; }
+	const u32* versions() const { return m_versions.data(); }
+	void markChanged(u32 row) { m_versions[row] = *m_tick; touch(*m_tick); }
+
+	/// Highest version in the column (or above), change queries skip columns older than they ask for.
+	u32 lastChange() const { return m_lastChange.load(std::memory_order_relaxed); }
+
+	virtual Component* get(u32 row) = 0;
+	virtual u32 size() const = 0;
+
+	virtual ComponentID id() const = 0;
+	virtual TypeIndex type() const = 0;
+
+	/// Moves the component at 'row' to the end of 'dest' (which must hold the same type).
+	virtual void moveTo(u32 row, ComponentArrayBase& dest) = 0;
+
+	/// Destroys the component at 'row' and fills the hole with the last one.
+	virtual void swapRemove(u32 row) = 0;
+
+	/// Makes room for 'count' components without further allocations.
+	virtual void reserve(u32 count) = 0;
+
+	virtual uptr<ComponentArrayBase> createEmpty() const = 0;
+
+protected:
+	const u32* m_tick;
+	Vector<u32> m_versions;
+
+	// Parallel systems mark rows of the same column, hence atomic. Only written when it grows.
+	std::atomic<u32> m_lastChange{ 0 };
+
+	void touch(u32 tick) {
+		if (m_lastChange.load(std::memory_order_relaxed) < tick) {
+			m_lastChange.store(tick, std::memory_order_relaxed);
+		}
+	}
+};
+
+/// Allocation counters of one component type, see EntityWorld::poolStats().
+struct ComponentPoolStats {
+	ComponentID id;
+	TypeIndex type;
+	String name;      ///< Serializer name if the type has one, else its demangled C++ name
+	u32 live;         ///< Components currently stored
+	u32 capacity;     ///< Slots in the blocks owned by columns
+	u32 freeBlocks;   ///< Blocks parked on the free-lists
+	u32 freeCapacity; ///< Slots in the parked blocks
+	u32 heapBlocks;   ///< Blocks allocated from the heap so far, every other request reused a parked one
+
+	/// Fraction of the column slots actually in use, 0 when the columns hold no memory.
+	float occupancy() const { return capacity ? float(live) / float(capacity) : 0.0f; }
+
+	/// Fraction of all the memory held by the pool that isn't storing a component, 0 when it holds none.
+	float fragmentation() const {
+		u32 total = capacity + freeCapacity;
+		return total ? 1.0f - float(live) / float(total) : 0.0f;
+	}
+};
+
+class ComponentPoolBase {
+public:
+	virtual ~ComponentPoolBase() = default;
+	virtual ComponentPoolStats stats() const = 0;
+};
+
+/// Slab allocator backing every column of one component type. Blocks come in power-of-two
+/// size classes (ECS_POOL_MIN_BLOCK << n slots) and go back to a per-class free-list when a
+/// column grows or empties. A column only reaches the heap when no block of the class it
+/// needs is parked, so a world whose archetypes stop growing stops allocating.
+template <class C>
+class ComponentPool : public ComponentPoolBase {
+	template <class> friend class ComponentArray;
+public:
+	~ComponentPool() {
+		for (u32 sc = 0; sc < ECS_POOL_SIZE_CLASSES; sc++) {
+			for (C* block : m_free[sc]) {
+				::operator delete(block, std::align_val_t(alignof(C)));
+			}
+		}
+	}
+
+	static u32 blockSize(u32 sizeClass) { return u32(ECS_POOL_MIN_BLOCK) << sizeClass; }
+
+	C* allocate(u32 sizeClass) {
+		assert(sizeClass < ECS_POOL_SIZE_CLASSES && "Component column too large.");
+		m_capacity += blockSize(sizeClass);
+
+		Vector<C*>& list = m_free[sizeClass];
+		if (!list.empty()) {
+			C* block = list.back();
+			list.pop_back();
+			m_freeBlocks--;
+			m_freeCapacity -= blockSize(sizeClass);
+			return block;
+		}
+		m_heapBlocks++;
+		return static_cast<C*>(::operator new(sizeof(C) * blockSize(sizeClass), std::align_val_t(alignof(C))));
+	}
+
+	/// Parks an (already destructed) block for reuse.
+	void release(C* block, u32 sizeClass) {
+		m_capacity -= blockSize(sizeClass);
+		m_free[sizeClass].push_back(block);
+		m_freeBlocks++;
+		m_freeCapacity += blockSize(sizeClass);
+	}
+
+	ComponentPoolStats stats() const override {
+		return { getComponentID<C>(), getTypeIndex<C>(), String(), m_live, m_capacity, m_freeBlocks, m_freeCapacity, m_heapBlocks };
+	}
+
+private:
+	Array<Vector<C*>, ECS_POOL_SIZE_CLASSES> m_free;
+	u32 m_live{ 0 }, m_capacity{ 0 }, m_freeBlocks{ 0 }, m_freeCapacity{ 0 }, m_heapBlocks{ 0 };
+};
+
+/// Contiguous column storage taken from the world's ComponentPool<C>.
+template <class C>
+class ComponentArray : public ComponentArrayBase {
+public:
+	ComponentArray(ComponentPool<C>* pool, const u32* tick) : ComponentArrayBase(tick), m_pool(pool) {}
+	~ComponentArray() {
+		for (u32 i = 0; i < m_size; i++) {
+			m_data[i].~C();
+		}
+		m_pool->m_live -= m_size;
+		m_size = 0;
+		releaseBlock();
+	}
+
+	Component* get(u32 row) override { return &m_data[row]; }
+	u32 size() const override { return m_size; }
+	u32 capacity() const { return m_data ? ComponentPool<C>::blockSize(m_sizeClass) : 0; }
+
+	ComponentID id() const override { return getComponentID<C>(); }
+	TypeIndex type() const override { return getTypeIndex<C>(); }
+
+	void moveTo(u32 row, ComponentArrayBase& dest) override {
+		ComponentArray<C>& destArray = static_cast<ComponentArray<C>&>(dest);
+		destArray.emplace(mov(m_data[row]));
+		destArray.m_versions.back() = m_versions[row];
+	}
+
+	void swapRemove(u32 row) override {
+		if (row + 1 < m_size) {
+			m_data[row] = mov(m_data[m_size - 1]);
+			m_versions[row] = m_versions.back();
+		}
+		m_versions.pop_back();
+		m_data[m_size - 1].~C();
+		m_size--;
+		m_pool->m_live--;
+
+		// Empty archetypes give their memory back for other columns of this type
+		if (m_size == 0) {
+			releaseBlock();
+		}
+	}
+
+	void reserve(u32 count) override {
+		if (count <= capacity()) return;
+
+		u32 sizeClass = 0;
+		while (ComponentPool<C>::blockSize(sizeClass) < count) sizeClass++;
+		grow(sizeClass);
+		m_versions.reserve(count);
+	}
+
+	uptr<ComponentArrayBase> createEmpty() const override {
+		return uptr<ComponentArrayBase>(new ComponentArray<C>(m_pool, m_tick));
+	}
+
+	template <typename... Args>
+	C& emplace(Args&&... args) {
+		if (m_size == capacity()) {
+			grow(m_data ? m_sizeClass + 1 : 0);
+		}
+		C* comp = new (m_data + m_size) C(std::forward<Args>(args)...);
+		m_versions.push_back(*m_tick);
+		touch(*m_tick);
+		m_size++;
+		m_pool->m_live++;
+		return *comp;
+	}
+
+	C* data() { return m_data; }
+
+private:
+	ComponentPool<C>* m_pool;
+	C* m_data{ nullptr };
+	u32 m_size{ 0 }, m_sizeClass{ 0 };
+
+	void grow(u32 sizeClass) {
+		C* block = m_pool->allocate(sizeClass);
+		for (u32 i = 0; i < m_size; i++) {
+			new (block + i) C(mov(m_data[i]));
+			m_data[i].~C();
+		}
+		releaseBlock();
+		m_data = block;
+		m_sizeClass = sizeClass;
+	}
+
+	void releaseBlock() {
+		if (m_data) {
+			m_pool->release(m_data, m_sizeClass);
+			m_data = nullptr;
+		}
+	}
+};
+
+class EntityWorld;
+using ColumnFactory = uptr<ComponentArrayBase>(*)(EntityWorld&);
+using ComponentList = Vector<std::pair<TypeIndex, Component*>>;
+
+/// Saves/loads the columns of one component type in world snapshots, see EntityWorld::registerSerializer().
+struct ComponentSerializer {
+	ComponentID id;
+	String name;
+	u32 version;
+	ColumnFactory factory;
+
+	/// Writes every component of the column.
+	Fn<void(SnapshotWriter&, ComponentArrayBase&)> save;
+
+	/// Appends 'count' components, given the version they were saved with.
+	Fn<void(SnapshotReader&, ComponentArrayBase&, u32, u32)> load;
+};
+
+class Entity;
+
+/// Every entity with the exact same set of component types lives in the same Archetype.
+/// Components are stored in one contiguous column per type, and row 'i' of every column
+/// belongs to entities()[i].
+///
+/// NOTE: Adding/removing components or destroying entities moves rows around, so
+/// component references are only valid until the next structural change.
+class Archetype {
 	friend class EntityWorld;
 public:
-	Entity() = default;
-	virtual ~Entity() = default;
+	Archetype() {
+		m_columnIndex.fill(nullptr);
+		m_addEdges.fill(nullptr);
+		m_removeEdges.fill(nullptr);
+	}
 
-	template <class C, typename... Args>
-	C& assign(Args&&... args) {
-		static_assert(
-				std::is_base_of<Component, C>::value,
-				"Component must be derived from 'Component'."
-		);
-		m_components.insert(std::make_pair(getTypeIndex<C>(), uptr<C>(new C(args...))));
-		return *((C*) m_components.at(getTypeIndex<C>()).get());
+	bool has(ComponentID id) const { return m_mask.test(id); }
+
+	template <class... Cs>
+	bool hasAll() const {
+		const ComponentMask& mask = getComponentMask<Cs...>();
+		return (m_mask & mask) == mask;
 	}
 
 	template <class C>
-	bool remove() {
-		static_assert(
-				std::is_base_of<Component, C>::value,
-				"Component must be derived from 'Component'."
-		);
-		auto found = m_components.find(getTypeIndex<C>());
-		if (found != m_components.end()) {
-			m_components.erase(found);
-			return true;
+	ComponentArray<C>* column() {
+		return static_cast<ComponentArray<C>*>(m_columnIndex[getComponentID<C>()]);
+	}
+
+	ComponentArrayBase* column(ComponentID id) { return m_columnIndex[id]; }
+
+	const ComponentMask& mask() const { return m_mask; }
+	const Vector<ComponentID>& signature() const { return m_signature; }
+	const Vector<uptr<ComponentArrayBase>>& columns() const { return m_columns; }
+	Vector<Entity*>& entities() { return m_entities; }
+
+	u32 size() const { return m_entities.size(); }
+	bool empty() const { return m_entities.empty(); }
+
+	/// Calls func(entity, components...) for the rows in [begin, end).
+	template <class... Cs, class F>
+	void eachRow(F& func, u32 begin, u32 end, Cs*... columns) {
+		for (u32 i = begin; i < end; i++) {
+			func(*m_entities[i], columns[i]...);
 		}
-		return false;
 	}
 
+	/// Splits the rows in chunks that run on 'jobs' as part of 'group'.
+	template <class... Cs, class F>
+	void scheduleRows(JobSystem& jobs, JobGroup& group, F& func, Cs*... columns) {
+		u32 count = size();
+		u32 grain = std::max(u32(ECS_PARALLEL_MIN_CHUNK), count / (jobs.threadCount() * 4));
+
+		for (u32 begin = 0; begin < count; begin += grain) {
+			u32 end = std::min(begin + grain, count);
+			jobs.run(group, [this, &func, begin, end, columns...]() {
+				eachRow(func, begin, end, columns...);
+			});
+		}
+	}
+
+private:
+	ComponentMask m_mask;
+	Vector<ComponentID> m_signature;
+	Vector<uptr<ComponentArrayBase>> m_columns;
+	Array<ComponentArrayBase*, ECS_MAX_COMPONENTS> m_columnIndex;
+	Vector<Entity*> m_entities;
+
+	void addColumn(uptr<ComponentArrayBase> col);
+
+	// Cached archetype transitions, indexed by ComponentID
+	Array<Archetype*, ECS_MAX_COMPONENTS> m_addEdges, m_removeEdges;
+};
+
+/// Counts the iterations open on a world for as long as it lives. Iterating caches row counts
+/// and column pointers, so the world asserts there are none open on a structural change.
+class IterationScope {
+public:
+	explicit IterationScope(std::atomic<u32>& depth) : m_depth(depth) { m_depth++; }
+	~IterationScope() { m_depth--; }
+private:
+	std::atomic<u32>& m_depth;
+};
+
+class ViewBase {
+	friend class EntityWorld;
+public:
+	virtual ~ViewBase() = default;
+protected:
+	std::atomic<u32>* m_iterating = nullptr;
+
+	virtual void archetypeCreated(Archetype* arch) = 0;
+};
+
+/// Persistent query over every entity that has all of Cs, obtained through EntityWorld::view().
+/// The world hands every new archetype to its views, so the matching archetypes and their
+/// columns are resolved once; iterating never tests signatures or hashes component types.
+/// Since assign/remove/destroy only move rows between archetypes, the view is always current.
+template <class... Cs>
+class View : public ViewBase {
+	friend class EntityWorld;
+public:
+	template <class F>
+	void each(F&& func) {
+		IterationScope scope(*m_iterating);
+		for (u32 m = 0; m < m_matches.size(); m++) {
+			Match& match = m_matches[m];
+			if (match.archetype->empty()) continue;
+			match.archetype->eachRow(
+					func, 0, match.archetype->size(),
+					std::get<ComponentArray<Cs>*>(match.columns)->data()...
+			);
+		}
+	}
+
+	/// See EntityWorld::parallelEach().
+	template <class F>
+	void parallelEach(F&& func) {
+		IterationScope scope(*m_iterating);
+		JobSystem& jobs = JobSystem::get();
+		JobGroup group;
+		for (Match& match : m_matches) {
+			if (match.archetype->empty()) continue;
+			match.archetype->scheduleRows(
+					jobs, group, func,
+					std::get<ComponentArray<Cs>*>(match.columns)->data()...
+			);
+		}
+		jobs.wait(group);
+	}
+
+	/// Like each(), but skips entities whose C hasn't changed since the world tick 'since' (inclusive).
+	/// Archetypes where no C changed are skipped without looking at their rows.
+	template <class C, class F>
+	void eachChanged(u32 since, F&& func) {
+		static_assert((std::is_same<C, Cs>::value || ...), "The changed component must be part of the view.");
+		IterationScope scope(*m_iterating);
+		for (Match& match : m_matches) {
+			Archetype* arch = match.archetype;
+			ComponentArray<C>* changed = std::get<ComponentArray<C>*>(match.columns);
+			if (arch->empty() || changed->lastChange() < since) continue;
+
+			const u32* versions = changed->versions();
+			auto columns = std::make_tuple(std::get<ComponentArray<Cs>*>(match.columns)->data()...);
+			for (u32 i = 0; i < arch->size(); i++) {
+				if (versions[i] < since) continue;
+				func(*arch->entities()[i], std::get<Cs*>(columns)[i]...);
+			}
+		}
+	}
+
+	Entity* first() {
+		for (Match& match : m_matches) {
+			if (!match.archetype->empty()) return match.archetype->entities().front();
+		}
+		return nullptr;
+	}
+
+	u32 size() const {
+		u32 count = 0;
+		for (const Match& match : m_matches) count += match.archetype->size();
+		return count;
+	}
+
+	bool empty() const { return size() == 0; }
+
+protected:
+	void archetypeCreated(Archetype* arch) override {
+		if (arch->hasAll<Cs...>()) {
+			m_matches.push_back({ arch, std::make_tuple(arch->column<Cs>()...) });
+		}
+	}
+
+private:
+	struct Match {
+		Archetype* archetype;
+		std::tuple<ComponentArray<Cs>*...> columns;
+	};
+	Vector<Match> m_matches;
+};
+
+class EntityWorld;
+class Entity {
+	friend class EntityWorld;
+public:
+	virtual ~Entity() = default;
+
+	template <class C, typename... Args>
+	C& assign(Args&&... args);
+
+	template <class C>
+	bool remove();
+
 	void removeAll();
 
 	template <class C>
@@ -66,67 +514,344 @@ public:
 				std::is_base_of<Component, C>::value,
 				"Component must be derived from 'Component'."
 		);
-		return m_components.find(getTypeIndex<C>()) != m_components.end();
+		return m_archetype->has(getComponentID<C>());
 	}
 
 	template<typename T, typename V, typename... Types>
 	bool has() const {
-		return has<T>() && has<V, Types...>();
+		return m_archetype->hasAll<T, V, Types...>();
 	}
 
+	/// The components this entity has (shared with its archetype).
+	const ComponentMask& mask() const { return m_archetype->mask(); }
+
 	template <class C>
 	C* get() {
 		static_assert(
 				std::is_base_of<Component, C>::value,
 				"Component must be derived from 'Component'."
 		);
-		auto found = m_components.find(getTypeIndex<C>());
-		if (found == m_components.end()) {
+		ComponentArray<C>* col = m_archetype->column<C>();
+		if (col == nullptr) {
 			return nullptr;
 		}
-		return ((C*) found->second.get());
+		return &col->data()[m_row];
+	}
+
+	/// get() for writing: the component is flagged as changed at the current world tick.
+	template <class C>
+	C* modify() {
+		C* comp = get<C>();
+		if (comp) {
+			markChanged<C>();
+		}
+		return comp;
+	}
+
+	template <class C>
+	void markChanged() {
+		ComponentArray<C>* col = m_archetype->column<C>();
+		if (col) {
+			col->markChanged(m_row);
+		}
+	}
+
+	/// Whether C was assigned or changed at or after the world tick 'tick'.
+	template <class C>
+	bool changedSince(u32 tick) const {
+		ComponentArray<C>* col = m_archetype->column<C>();
+		return col && col->version(m_row) >= tick;
 	}
 
 	u64 id() const { return m_id; }
+	u32 index() const { return entityIndex(m_id); }
 
-	ComponentMap& components() { return m_components; }
+	ComponentList components();
 
 	String name() const;
 	void setName(const String& name);
 
+	void addTag(const String& tag);
+	void removeTag(const String& tag);
+	bool hasTag(const String& tag) const;
+	const Vector<Tag>& tags() const { return m_tags; }
+
+	EntityWorld& world() { return *m_world; }
+	Archetype* archetype() { return m_archetype; }
+
 protected:
+	Entity(EntityWorld* world)
+		: m_world(world), m_archetype(nullptr), m_row(0), m_listIndex(0), m_id(ECS_INVALID_ENTITY), m_announced(false)
+	{}
+
 	String m_name;
-	ComponentMap m_components;
+	EntityWorld* m_world;
+	Archetype* m_archetype;
+	u32 m_row, m_listIndex;
 	u64 m_id;
+	bool m_announced; // The systems were told about its creation
+	Vector<Tag> m_tags;
 };
 
-class EntityWorld;
 class EntitySystem {
+	friend class EntityWorld;
 public:
-	virtual ~EntitySystem() = default;
+	virtual ~EntitySystem() { MessageSystem::get().unsubscribe(this); }
 	virtual void update(EntityWorld& world, float dt) {}
 	virtual void render(EntityWorld& world, FrameBuffer* target, Entity* pov) {}
 	virtual void entityCreated(EntityWorld& world, Entity& ent) {}
 	virtual void entityDestroyed(EntityWorld& world, Entity& ent) {}
-	virtual void messageReceived(EntityWorld& world, const Message& msg) {}
+
+	/// Batched notifications, called once per sync point. Forward to entityCreated/entityDestroyed by default.
+	virtual void entitiesCreated(EntityWorld& world, const Vector<Entity*>& ents) {
+		for (Entity* ent : ents) entityCreated(world, *ent);
+	}
+	virtual void entitiesDestroyed(EntityWorld& world, const Vector<Entity*>& ents) {
+		for (Entity* ent : ents) entityDestroyed(world, *ent);
+	}
+
+	/// Systems that never declared their component access are assumed to touch
+	/// everything, and always update alone on the calling thread.
+	bool declaresAccess() const { return m_declaresAccess; }
+	bool conflictsWith(const EntitySystem& other) const;
+
+	const ComponentMask& readSet() const { return m_reads; }
+	const ComponentMask& writeSet() const { return m_writes; }
+
+	/// Signature set by watches(), empty when the system hears about every entity.
+	const ComponentMask& watchMask() const { return m_watch; }
+	bool watching(const ComponentMask& mask) const { return (mask & m_watch) == m_watch; }
+
+	/// World tick of this system's previous update (0 before the first one). Pass it to the
+	/// change queries to find what changed since then, including the writes of that update's stage.
+	u32 lastRun() const { return m_lastRun; }
+
+protected:
+	/// Declares the component types update() reads/writes. A system that declares its
+	/// access may run on a worker thread next to non-conflicting systems, so its update()
+	/// must record structural changes in world.commands() instead of applying them.
+	template <class... Cs>
+	void reads() {
+		m_reads |= getComponentMask<Cs...>();
+		m_declaresAccess = true;
+	}
+
+	template <class... Cs>
+	void writes() {
+		m_writes |= getComponentMask<Cs...>();
+		m_declaresAccess = true;
+	}
+
+	/// Declares that update() touches no components at all, so it never conflicts with another system.
+	void declaresNoComponents() {
+		m_declaresAccess = true;
+	}
+
+	/// Only notifies this system about entities that have all of Cs. Entities entering the
+	/// signature through assign() are passed to entityCreated() once the component is in place,
+	/// the ones leaving it through remove() to entityDestroyed() while it's still readable.
+	/// Handlers must not add/remove components or destroy that entity (use commands()).
+	template <class... Cs>
+	void watches() {
+		m_watch |= getComponentMask<Cs...>();
+	}
+
+private:
+	ComponentMask m_reads, m_writes, m_watch;
+	bool m_declaresAccess{ false };
+	u32 m_lastRun{ 0 };
 };
 
-using EntityList = Vector<uptr<Entity>>;
+using EntityList = Vector<Entity*>;
 using SystemList = Vector<uptr<EntitySystem>>;
+using ArchetypeList = Vector<uptr<Archetype>>;
 
-class EntityWorld : public IObject {
+/// Component template for EntityWorld::instantiate(), every instance gets a copy of each component.
+template <class... Cs>
+class Prefab {
 public:
-	EntityWorld() { MessageSystem::get().subscribe(this); }
-	virtual ~EntityWorld() = default;
+	explicit Prefab(Cs... components) : m_components(mov(components)...) {}
+
+	template <class C>
+	C& get() { return std::get<C>(m_components); }
+
+	const std::tuple<Cs...>& components() const { return m_components; }
+
+private:
+	std::tuple<Cs...> m_components;
+};
+
+/// Records structural changes (create/destroy/assign/remove) to be played back later, at a
+/// sync point of EntityWorld::update() or through EntityWorld::playbackCommands().
+/// Use the buffer returned by EntityWorld::commands() from inside each()/parallelEach() and
+/// from parallel systems. The owner thread and the pool workers each get their own buffer, so
+/// recording needs no locking. Other threads share one buffer that locks on every record, they
+/// should hold() it around a create() and the commands that use its Pending.
+///
+/// Commands run in the order they were recorded, except destroys which run after everything
+/// else in the same playback. Commands aimed at entities that died in the meantime are dropped.
+class CommandBuffer {
+	friend class EntityWorld;
+public:
+	explicit CommandBuffer(bool shared = false) : m_shared(shared) {}
+
+	/// Stand-in for an entity that will exist once the buffer that created it is played back.
+	/// It can't be used after that playback.
+	struct Pending {
+		CommandBuffer* buffer;
+		u32 index;
+		u32 generation;
+	};
+
+	Pending create(const String& name = "") {
+		Guard guard(*this);
+		m_commands.push_back({ Command::Create, m_pendingCount, true, name, nullptr });
+		return { this, m_pendingCount++, m_generation };
+	}
+
+	void destroy(u64 id) {
+		Guard guard(*this);
+		m_commands.push_back({ Command::Destroy, id, false, "", nullptr });
+	}
+
+	template <class C, typename... Args>
+	void assign(u64 id, Args&&... args) {
+		record(id, false, assignOp<C>(std::forward<Args>(args)...));
+	}
+
+	template <class C, typename... Args>
+	void assign(Pending ent, Args&&... args) {
+		assert(ent.buffer == this && "Pending entities belong to the buffer that created them.");
+		record(ent, assignOp<C>(std::forward<Args>(args)...));
+	}
+
+	template <class C>
+	void remove(u64 id) {
+		record(id, false, [](Entity& ent) { ent.remove<C>(); });
+	}
+
+	template <class C>
+	void remove(Pending ent) {
+		assert(ent.buffer == this && "Pending entities belong to the buffer that created them.");
+		record(ent, [](Entity& ent) { ent.remove<C>(); });
+	}
+
+	bool empty() const { Guard guard(*this); return m_commands.empty(); }
+
+	/// On the shared buffer, holds playback off while the returned lock lives, so that a create()
+	/// and the commands using its Pending end up in the same playback. Does nothing on the others.
+	std::unique_lock<std::recursive_mutex> hold() {
+		Guard guard(*this);
+		return mov(guard.lock);
+	}
+
+private:
+	struct Command {
+		enum Type { Create, Destroy, Apply } type;
+		u64 target; // Entity id, or the index of a pending entity
+		bool pending;
+		String name;
+		Fn<void(Entity&)> apply;
+	};
+
+	// Locks the buffer if it's the one shared by threads outside the job system
+	struct Guard {
+		explicit Guard(const CommandBuffer& cmds) : lock(cmds.m_lock, std::defer_lock) {
+			if (cmds.m_shared) lock.lock();
+		}
+		std::unique_lock<std::recursive_mutex> lock;
+	};
 
-	void processMessage(const Message& msg) override;
+	Vector<Command> m_commands;
+	u32 m_pendingCount{ 0 }, m_generation{ 0 };
 
+	const bool m_shared;
+	mutable std::recursive_mutex m_lock;
+
+	void record(u64 target, bool pending, Fn<void(Entity&)>&& apply) {
+		Guard guard(*this);
+		m_commands.push_back({ Command::Apply, target, pending, "", mov(apply) });
+	}
+
+	void record(const Pending& ent, Fn<void(Entity&)>&& apply) {
+		Guard guard(*this);
+		assert(ent.generation == m_generation && "The pending entity was already played back.");
+		m_commands.push_back({ Command::Apply, ent.index, true, "", mov(apply) });
+	}
+
+	template <class C, typename... Args>
+	static Fn<void(Entity&)> assignOp(Args&&... args) {
+		return [args = std::make_tuple(std::forward<Args>(args)...)](Entity& ent) mutable {
+			std::apply([&ent](auto&&... a) { ent.assign<C>(mov(a)...); }, mov(args));
+		};
+	}
+
+	void clear() {
+		m_commands.clear();
+		m_pendingCount = 0;
+		m_generation++;
+	}
+};
+
+class EntityWorld {
+	friend class Entity;
+public:
+	EntityWorld();
+	virtual ~EntityWorld() = default;
+
+	/// Immediate structural changes. They assert while iterating and aren't safe from parallel
+	/// systems, see commands().
 	Entity& create(const String& name = "");
 	void destroy(Entity& entity);
+	void destroy(u64 id);
+
+	/// Creates 'count' entities straight into the prefab's archetype, copying its components.
+	/// Storage is reserved once, init(entity, i) may then customize each instance. Systems hear
+	/// about the whole batch through a single entitiesCreated() call at the next sync point.
+	template <class... Cs>
+	EntityList instantiate(
+			const Prefab<Cs...>& prefab, u32 count,
+			const Fn<void(Entity&, u32)>& init = nullptr,
+			const String& name = ""
+	) {
+		Archetype* arch = rootArchetype();
+		((arch = archetypeAdd(arch, getComponentID<Cs>(), &createColumn<Cs>)), ...);
+
+		u32 total = arch->size() + count;
+		(arch->column<Cs>()->reserve(total), ...);
+		arch->m_entities.reserve(total);
+		m_entities.reserve(m_entities.size() + count);
+		m_recentlyCreated.reserve(m_recentlyCreated.size() + count);
 
+		EntityList ret;
+		ret.reserve(count);
+		for (u32 i = 0; i < count; i++) {
+			Entity& ent = createIn(arch, name);
+			(arch->column<Cs>()->emplace(std::get<Cs>(prefab.components())), ...);
+			ret.push_back(&ent);
+		}
+
+		if (init) {
+			for (u32 i = 0; i < count; i++) {
+				init(*ret[i], i);
+			}
+		}
+		return ret;
+	}
+
+	/// The command buffer of the calling thread: its own one on the thread that created the world
+	/// and on the JobSystem workers, a shared locked one on any other thread (loaders, audio...).
+	CommandBuffer& commands();
+
+	/// Applies every recorded command, then sends the batched created/destroyed notifications.
+	/// update() calls this before the first and after each system stage.
+	void playbackCommands();
+
+	/// Calls func(entity, components...) for every entity that has all of them. Structural
+	/// changes from inside 'func' assert, they must go through commands().
 	template<class... Cs>
 	void each(void(*f)(Entity&, Cs...)) {
-		each_internal_parallel<Cs...>(f);
+		each_internal<std::decay_t<Cs>...>(f);
 	}
 
 	template <class F>
@@ -134,6 +859,13 @@ public:
 		lambda_each_internal(&F::operator(), func);
 	}
 
+	/// Like each(), but every matching archetype is split in chunks that run on the JobSystem.
+	/// 'func' is called concurrently, structural changes must go through commands().
+	template <class F>
+	void parallelEach(F&& func) {
+		lambda_parallel_each_internal(&F::operator(), func);
+	}
+
 	template <class S, typename... Args>
 	S& registerSystem(Args&&... args) {
 		static_assert(
@@ -141,57 +873,328 @@ public:
 				"System must be derived from 'EntitySystem'."
 		);
 		m_systems.push_back(uptr<S>(new S(args...)));
+		m_scheduleDirty = true;
 		return *((S*) m_systems.back().get());
 	}
 
+	/// Returns the cached view for Cs, creating it on first use.
+	template <class... Cs>
+	View<Cs...>& view() {
+		std::lock_guard<std::mutex> lock(m_viewLock);
+
+		TypeIndex key = getTypeIndex<View<Cs...>>();
+		auto found = m_views.find(key);
+		if (found != m_views.end()) {
+			return *static_cast<View<Cs...>*>(found->second.get());
+		}
+
+		View<Cs...>* v = new View<Cs...>();
+		v->m_iterating = &m_iterating;
+		for (uptr<Archetype>& arch : m_archetypes) {
+			v->archetypeCreated(arch.get());
+		}
+		m_views[key] = uptr<ViewBase>(v);
+		return *v;
+	}
+
+	/// First entity having C, only visits the archetypes that contain C.
 	template <class C>
 	Entity* find() {
-		for (uptr<Entity>& ent : m_entities) {
-			if (ent->has<C>()) return ent.get();
+		for (Archetype* arch : m_componentArchetypes[getComponentID<C>()]) {
+			if (!arch->empty()) {
+				return arch->entities().front();
+			}
 		}
 		return nullptr;
 	}
 
+	/// Every entity having C.
+	template <class C>
+	EntityList findAll() {
+		EntityList ret;
+		for (Archetype* arch : m_componentArchetypes[getComponentID<C>()]) {
+			ret.insert(ret.end(), arch->entities().begin(), arch->entities().end());
+		}
+		return ret;
+	}
+
+	/// Hashed lookups, kept up to date by create/destroy/setName. Empty names aren't indexed.
+	Entity* findByName(const String& name);
+	const EntityList& findAllByName(const String& name);
+
+	/// Interns 'name', the same string always gives the same tag.
+	Tag tag(const String& name);
+	const EntityList& tagged(const String& tag);
+	const EntityList& tagged(Tag tag);
+
 	void update(float dt);
-	void render(FrameBuffer* target = nullptr, Entity* pov = nullptr);
+	/// 'alpha' is how far rendering is between the last two updates (0 = previous, 1 = latest),
+	/// systems read it through renderAlpha() to interpolate what moved.
+	void render(FrameBuffer* target = nullptr, Entity* pov = nullptr, float alpha = 1.0f);
+	float renderAlpha() const { return m_renderAlpha; }
+
+	/// All alive entities, in no particular order.
+	const EntityList& entities() const { return m_entities; }
 
-	EntityList& entities() { return m_entities; }
+	bool alive(u64 id) const;
 	Entity* getEntity(u64 id);
 
+	/// Looks up the alive entity in a slot, for places where the generation was lost (e.g. GPU picking).
+	Entity* entityAt(u32 index);
+
+	ArchetypeList& archetypes() { return m_archetypes; }
+
+	/// Preallocates room for 'count' entities with exactly the components Cs, for bulk spawning.
+	template <class... Cs>
+	void reserve(u32 count) {
+		Archetype* arch = rootArchetype();
+		((arch = archetypeAdd(arch, getComponentID<Cs>(), &createColumn<Cs>)), ...);
+		for (uptr<ComponentArrayBase>& col : arch->m_columns) {
+			col->reserve(count);
+		}
+		arch->m_entities.reserve(count);
+	}
+
+	/// Components assigned or changed during the current system stage are stamped with this.
+	/// It advances after every stage of update().
+	u32 changeTick() const { return m_changeTick; }
+
+	/// Allocation statistics of every component type used in this world.
+	Vector<ComponentPoolStats> poolStats() const;
+
+	/// Makes C part of snapshots. 'name' identifies the type across builds, and 'version' is
+	/// handed back to 'load' so it can read data written by older versions of 'save'.
+	/// 'load' receives a default constructed component.
+	template <class C>
+	void registerSerializer(
+			const String& name, u32 version,
+			const Fn<void(SnapshotWriter&, const C&)>& save,
+			const Fn<void(SnapshotReader&, C&, u32)>& load
+	) {
+		static_assert(std::is_default_constructible<C>::value, "Serialized components must be default constructible.");
+
+		ComponentSerializer* ser = new ComponentSerializer();
+		ser->id = getComponentID<C>();
+		ser->name = name;
+		ser->version = version;
+		ser->factory = &createColumn<C>;
+		ser->save = [save](SnapshotWriter& out, ComponentArrayBase& col) {
+			ComponentArray<C>& arr = static_cast<ComponentArray<C>&>(col);
+			for (u32 i = 0; i < arr.size(); i++) {
+				save(out, arr.data()[i]);
+			}
+		};
+		ser->load = [load](SnapshotReader& in, ComponentArrayBase& col, u32 count, u32 version) {
+			ComponentArray<C>& arr = static_cast<ComponentArray<C>&>(col);
+			arr.reserve(arr.size() + count);
+			for (u32 i = 0; i < count; i++) {
+				load(in, arr.emplace(), version);
+			}
+		};
+		m_serializers[ser->id] = uptr<ComponentSerializer>(ser);
+	}
+
+	/// Writes every entity with the components that have a serializer. Each archetype is stored
+	/// as a block of entities followed by one contiguous run of bytes per column.
+	Vector<u8> saveSnapshot();
+
+	/// Adds the entities of a snapshot to the world, without moving them between archetypes.
+	/// 'data' is only read during the call, so it can be a memory-mapped file. Components whose
+	/// type isn't registered here are skipped. Returns false if the data is malformed, in which
+	/// case the world is left as it was (a few empty archetypes aside).
+	bool loadSnapshot(const u8* data, u64 size);
+
 private:
-	Vector<Entity*> m_recentlyCreated, m_recentlyDestroyed;
+	struct EntitySlot {
+		uptr<Entity> entity;
+		u32 generation;
+		bool alive;
+	};
+
+	/// A run of systems executed together. Exclusive stages hold a single system that runs
+	/// on the calling thread, the others run on the JobSystem as their dependencies finish.
+	struct SystemStage {
+		bool exclusive;
+		Vector<u32> systems;
+		Vector<Vector<u32>> dependents;
+		Vector<u32> dependencyCount;
+	};
+
+	Vector<SystemStage> m_schedule;
+	bool m_scheduleDirty{ true };
+
+	void buildSchedule();
+	void runStage(const SystemStage& stage, float dt);
+
+	// One per JobSystem thread, indexed by JobSystem::threadIndex(). Index 0 is the thread
+	// that created the world, threads outside the job system record into m_sharedCommands.
+	Vector<uptr<CommandBuffer>> m_commandBuffers;
+	CommandBuffer m_sharedCommands{ true };
+	std::thread::id m_ownerThread;
+
+	/// Plays 'cmds' back until it stays empty, returns whether it had anything.
+	bool playback(CommandBuffer& cmds, Vector<u64>& destroyed);
+	void announceCreated();
+
+	// Batched, filtered by each system's watched signature
+	void notifyCreated(const EntityList& ents);
+	void notifyDestroyed(const EntityList& ents);
+
+	/// Tells the watching systems about an announced entity whose components changed.
+	void signatureEntered(Entity& ent, const ComponentMask& before);
+	void signatureLeaving(Entity& ent, const ComponentMask& after);
+
+	/// Destroys without notifying the systems.
+	void destroyEntity(Entity& entity);
+
+	Vector<u64> m_recentlyCreated;
+	Vector<EntitySlot> m_slots;
+	Vector<u32> m_freeSlots;
 	EntityList m_entities;
 	SystemList m_systems;
 
-	template<class... Cs, class F>
-	void each_internal_parallel(F&& func) {
-		std::for_each(m_entities.begin(), m_entities.end(), [func](uptr<Entity>& ent){
-			if(ent->has<Cs...>()) {
-				func(*ent, *ent->get<Cs>()...);
-			}
-		});
+	u32 m_changeTick{ 1 };
+	float m_renderAlpha{ 1.0f };
+
+	// Declared before the archetypes, columns hand their blocks back on destruction
+	Array<uptr<ComponentPoolBase>, ECS_MAX_COMPONENTS> m_pools;
+	Array<uptr<ComponentSerializer>, ECS_MAX_COMPONENTS> m_serializers;
+
+	ArchetypeList m_archetypes;
+	UMap<ComponentMask, Archetype*> m_archetypeIndex;
+	Array<Vector<Archetype*>, ECS_MAX_COMPONENTS> m_componentArchetypes;
+
+	UMap<String, EntityList> m_nameIndex;
+	UMap<String, Tag> m_tagIDs;
+	Vector<EntityList> m_tagged;
+
+	void indexName(Entity& ent);
+	void unindexName(Entity& ent);
+
+	UMap<TypeIndex, uptr<ViewBase>> m_views;
+	std::mutex m_viewLock;
+
+	// each()/view iterations in progress, on any thread
+	std::atomic<u32> m_iterating{0};
+
+	template <class C>
+	static uptr<ComponentArrayBase> createColumn(EntityWorld& world) {
+		return uptr<ComponentArrayBase>(new ComponentArray<C>(world.pool<C>(), &world.m_changeTick));
+	}
+
+	template <class C>
+	ComponentPool<C>* pool() {
+		uptr<ComponentPoolBase>& p = m_pools[getComponentID<C>()];
+		if (!p) {
+			p.reset(new ComponentPool<C>());
+		}
+		return static_cast<ComponentPool<C>*>(p.get());
+	}
+
+	Archetype* rootArchetype() { return m_archetypes.front().get(); }
+
+	/// Allocates an entity whose row in 'arch' the caller fills, and queues its creation notice.
+	Entity& createIn(Archetype* arch, const String& name);
+	Archetype* createArchetype(const ComponentMask& mask);
+	Archetype* archetypeAdd(Archetype* src, ComponentID id, ColumnFactory factory);
+	Archetype* archetypeRemove(Archetype* src, ComponentID id);
+
+	/// Moves the entity (and the components shared by both archetypes) to 'dest'.
+	/// Columns only present in 'dest' must already have been filled by the caller.
+	void moveEntity(Entity& ent, Archetype* dest);
+	void removeRow(Archetype* arch, u32 row);
+
+	template <class C, typename... Args>
+	C& assignComponent(Entity& ent, Args&&... args) {
+		assert(alive(ent.id()) && "Can't assign components to a destroyed entity.");
+		assert(m_iterating == 0 && "Structural change while iterating, record it through commands().");
+		C* existing = ent.get<C>();
+		if (existing) {
+			return *existing;
+		}
+
+		Archetype* src = ent.m_archetype;
+		Archetype* dest = archetypeAdd(src, getComponentID<C>(), &createColumn<C>);
+		C& comp = dest->column<C>()->emplace(std::forward<Args>(args)...);
+		moveEntity(ent, dest);
+		signatureEntered(ent, src->mask());
+		return comp;
+	}
+
+	template <class C>
+	bool removeComponent(Entity& ent) {
+		assert(alive(ent.id()) && "Can't remove components from a destroyed entity.");
+		assert(m_iterating == 0 && "Structural change while iterating, record it through commands().");
+		if (!ent.has<C>()) {
+			return false;
+		}
+		Archetype* dest = archetypeRemove(ent.m_archetype, getComponentID<C>());
+		signatureLeaving(ent, dest->mask());
+		moveEntity(ent, dest);
+		return true;
 	}
 
 	template<class... Cs, class F>
 	void each_internal(F&& func) {
-		for(uptr<Entity>& ent : m_entities) {
-			if(ent->has<Cs...>()) {
-				func(*ent, *ent->get<Cs>()...);
-			}
+		IterationScope scope(m_iterating);
+		for (u32 a = 0; a < m_archetypes.size(); a++) {
+			Archetype* arch = m_archetypes[a].get();
+			if (arch->empty() || !arch->hasAll<Cs...>()) continue;
+			arch->eachRow(func, 0, arch->size(), arch->column<Cs>()->data()...);
+		}
+	}
+
+	template<class... Cs, class F>
+	void parallel_each_internal(F&& func) {
+		IterationScope scope(m_iterating);
+		JobSystem& jobs = JobSystem::get();
+		JobGroup group;
+		for (uptr<Archetype>& arch : m_archetypes) {
+			if (arch->empty() || !arch->hasAll<Cs...>()) continue;
+			arch->scheduleRows(jobs, group, func, arch->column<Cs>()->data()...);
 		}
+		jobs.wait(group);
 	}
 
 	template<class G, class... Cs, class F>
 	void lambda_each_internal(void (G::*)(Entity&, Cs&...), F&& f) {
-		each_internal_parallel<Cs...>(std::forward<F>(f));
+		each_internal<Cs...>(std::forward<F>(f));
 	}
 
 	template<class G, class... Cs, class F>
 	void lambda_each_internal(void (G::*)(Entity&, Cs&...) const, F&& f) {
-		each_internal_parallel<Cs...>(std::forward<F>(f));
+		each_internal<Cs...>(std::forward<F>(f));
+	}
+
+	template<class G, class... Cs, class F>
+	void lambda_parallel_each_internal(void (G::*)(Entity&, Cs&...), F&& f) {
+		parallel_each_internal<Cs...>(std::forward<F>(f));
+	}
+
+	template<class G, class... Cs, class F>
+	void lambda_parallel_each_internal(void (G::*)(Entity&, Cs&...) const, F&& f) {
+		parallel_each_internal<Cs...>(std::forward<F>(f));
 	}
 };
 
+template <class C, typename... Args>
+C& Entity::assign(Args&&... args) {
+	static_assert(
+			std::is_base_of<Component, C>::value,
+			"Component must be derived from 'Component'."
+	);
+	return m_world->assignComponent<C>(*this, std::forward<Args>(args)...);
+}
+
+template <class C>
+bool Entity::remove() {
+	static_assert(
+			std::is_base_of<Component, C>::value,
+			"Component must be derived from 'Component'."
+	);
+	return m_world->removeComponent<C>(*this);
+}
+
 NS_END
 
 #endif /* ECS_H */
@@ -0,0 +1,126 @@
+#include "jobs.h"
+
+NS_BEGIN
+
+static thread_local const JobSystem* t_owner = nullptr;
+static thread_local u32 t_queue = 0;
+
+void JobSystem::WorkQueue::push(Task&& task) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_tasks.push_back(mov(task));
+}
+
+bool JobSystem::WorkQueue::pop(Task& task) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_tasks.empty()) return false;
+	task = mov(m_tasks.back());
+	m_tasks.pop_back();
+	return true;
+}
+
+bool JobSystem::WorkQueue::steal(Task& task) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_tasks.empty()) return false;
+	task = mov(m_tasks.front());
+	m_tasks.pop_front();
+	return true;
+}
+
+JobSystem::JobSystem(u32 workers)
+	: m_running(true), m_queued(0)
+{
+	for (u32 i = 0; i <= workers; i++) {
+		m_queues.push_back(uptr<WorkQueue>(new WorkQueue()));
+	}
+	for (u32 i = 1; i <= workers; i++) {
+		m_workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_running = false;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+}
+
+JobSystem& JobSystem::get() {
+	static JobSystem instance(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+	return instance;
+}
+
+void JobSystem::run(JobGroup& group, const Job& job) {
+	group.m_pending.fetch_add(1, std::memory_order_relaxed);
+	m_queues[threadIndex()]->push({ job, &group });
+	m_queued.fetch_add(1, std::memory_order_release);
+
+	// Taking the lock orders this against a worker checking 'm_queued' before sleeping
+	{ std::lock_guard<std::mutex> lock(m_sleepLock); }
+	m_wake.notify_one();
+}
+
+void JobSystem::wait(JobGroup& group) {
+	u32 queue = threadIndex();
+	while (!group.done()) {
+		if (!runOne(queue)) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::parallelFor(u32 count, u32 grain, const Fn<void(u32, u32)>& fn) {
+	if (count == 0) return;
+
+	grain = std::max(grain, 1u);
+	if (count <= grain || m_workers.empty()) {
+		fn(0, count);
+		return;
+	}
+
+	JobGroup group;
+	for (u32 begin = 0; begin < count; begin += grain) {
+		u32 end = std::min(begin + grain, count);
+		run(group, [&fn, begin, end]() { fn(begin, end); });
+	}
+	wait(group);
+}
+
+u32 JobSystem::threadIndex() const {
+	return t_owner == this ? t_queue : 0;
+}
+
+bool JobSystem::runOne(u32 queue) {
+	Task task;
+	bool found = m_queues[queue]->pop(task);
+
+	for (u32 i = 1; !found && i < m_queues.size(); i++) {
+		found = m_queues[(queue + i) % m_queues.size()]->steal(task);
+	}
+	if (!found) return false;
+
+	m_queued.fetch_sub(1, std::memory_order_relaxed);
+	task.job();
+	task.group->m_pending.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+void JobSystem::workerLoop(u32 queue) {
+	t_owner = this;
+	t_queue = queue;
+
+	while (m_running) {
+		if (runOne(queue)) continue;
+
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_wake.wait(lock, [this]() {
+			return !m_running || m_queued.load(std::memory_order_acquire) > 0;
+		});
+	}
+}
+
+NS_END
@@ -0,0 +1,89 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "types.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+NS_BEGIN
+
+using Job = Fn<void()>;
+
+/// Tracks a batch of jobs (fork), JobSystem::wait() on it to join them.
+class JobGroup {
+	friend class JobSystem;
+public:
+	JobGroup() : m_pending(0) {}
+
+	bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+	JobGroup(const JobGroup&) = delete;
+	JobGroup& operator =(const JobGroup&) = delete;
+private:
+	std::atomic<u32> m_pending;
+};
+
+/// Fixed pool of worker threads, one per core (the thread that waits on a group
+/// also runs jobs). Each thread owns a deque: the owner pushes/pops at the back,
+/// idle threads steal from the front of the others.
+class JobSystem {
+public:
+	explicit JobSystem(u32 workers);
+	~JobSystem();
+
+	/// Queues 'job' on the calling thread's deque.
+	void run(JobGroup& group, const Job& job);
+
+	/// Runs queued jobs on the calling thread until every job in 'group' has finished.
+	void wait(JobGroup& group);
+
+	/// Splits [0, count) into ranges of at most 'grain' items and calls fn(begin, end) in parallel.
+	void parallelFor(u32 count, u32 grain, const Fn<void(u32, u32)>& fn);
+
+	/// 0 on the main thread (and any thread that isn't a worker), 1..workerCount() on the workers.
+	u32 threadIndex() const;
+
+	u32 workerCount() const { return m_workers.size(); }
+	u32 threadCount() const { return m_workers.size() + 1; }
+
+	static JobSystem& get();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator =(const JobSystem&) = delete;
+private:
+	struct Task {
+		Job job;
+		JobGroup* group;
+	};
+
+	class WorkQueue {
+	public:
+		void push(Task&& task);
+		bool pop(Task& task);
+		bool steal(Task& task);
+	private:
+		std::mutex m_lock;
+		std::deque<Task> m_tasks;
+	};
+
+	// Queue 0 belongs to the main thread (and any thread that isn't a worker)
+	Vector<uptr<WorkQueue>> m_queues;
+	Vector<std::thread> m_workers;
+
+	std::atomic<bool> m_running;
+	std::atomic<u32> m_queued;
+
+	std::mutex m_sleepLock;
+	std::condition_variable m_wake;
+
+	bool runOne(u32 queue);
+	void workerLoop(u32 queue);
+};
+
+NS_END
+
+#endif // JOBS_H
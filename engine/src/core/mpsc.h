@@ -0,0 +1,85 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include "types.h"
+
+#include <atomic>
+
+NS_BEGIN
+
+/// Bounded lock-free queue, any number of threads may push but only one may pop.
+/// Every cell carries a sequence number telling producers and the consumer whose turn it is,
+/// so pushing is a single CAS on the tail and nothing is allocated after construction.
+template <class T>
+class MPSCQueue {
+public:
+	/// 'capacity' is rounded up to a power of two.
+	explicit MPSCQueue(u32 capacity) {
+		u32 size = 2;
+		while (size < capacity) size <<= 1;
+
+		m_cells.reset(new Cell[size]);
+		m_mask = size - 1;
+		for (u32 i = 0; i < size; i++) {
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		m_tail.store(0, std::memory_order_relaxed);
+		m_head = 0;
+	}
+
+	/// Returns false when the queue is full.
+	bool push(T&& value) {
+		u64 pos = m_tail.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;) {
+			cell = &m_cells[pos & m_mask];
+			u64 seq = cell->sequence.load(std::memory_order_acquire);
+			i64 diff = i64(seq) - i64(pos);
+			if (diff == 0) {
+				if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->value = mov(value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// Consumer only.
+	bool pop(T& out) {
+		Cell& cell = m_cells[m_head & m_mask];
+		u64 seq = cell.sequence.load(std::memory_order_acquire);
+		if (i64(seq) - i64(m_head + 1) < 0) {
+			return false;
+		}
+
+		out = mov(cell.value);
+		cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+		m_head++;
+		return true;
+	}
+
+	MPSCQueue(const MPSCQueue&) = delete;
+	MPSCQueue& operator =(const MPSCQueue&) = delete;
+
+private:
+	struct Cell {
+		std::atomic<u64> sequence;
+		T value;
+	};
+
+	uptr<Cell[]> m_cells;
+	u64 m_mask;
+
+	// Producers and the consumer work on different cache lines
+	alignas(64) std::atomic<u64> m_tail;
+	alignas(64) u64 m_head;
+};
+
+NS_END
+
+#endif // MPSC_H
@@ -4,29 +4,38 @@ NS_BEGIN
 
 uptr<MessageSystem> MessageSystem::s_ston(new MessageSystem());
 
-void MessageSystem::subscribe(IObject* obj) {
-	m_subscribers.push_back(obj);
+MessageSystem::~MessageSystem() {
+	for (std::atomic<MessageChannelBase*>& chan : m_channels) {
+		delete chan.load();
+	}
 }
 
-void MessageSystem::submit(const String& type, void* data, float delay) {
-	Message* msg = new Message();
-	msg->time = delay;
-	msg->type = type;
-	msg->data = mov(data);
-	m_messages.push(uptr<Message>(mov(msg)));
+void MessageSystem::unsubscribe(const void* owner) {
+	for (std::atomic<MessageChannelBase*>& chan : m_channels) {
+		MessageChannelBase* ptr = chan.load(std::memory_order_acquire);
+		if (ptr) {
+			ptr->unsubscribe(owner);
+		}
+	}
 }
 
 void MessageSystem::processQueue(float dt) {
-	if (!m_messages.empty()) {
-		m_messages.front()->time -= dt;
-		if (m_messages.front()->time <= 0) {
-			auto msg = mov(m_messages.front());
-			m_messages.pop();
-
-			for (auto sub : m_subscribers) {
-				sub->processMessage(*msg);
-			}
-			SAFE_RELEASE(msg->data);
+	// Messages posted from any thread since the last call join their queue (or the timer wheel)
+	for (std::atomic<MessageChannelBase*>& chan : m_channels) {
+		MessageChannelBase* ptr = chan.load(std::memory_order_acquire);
+		if (ptr) {
+			ptr->collect(m_timers);
+		}
+	}
+
+	// Everything that came due joins its channel queue, to be delivered right below
+	m_timers.advance(dt);
+
+	// A handler may post a message of a brand new type, it is picked up on the next call
+	for (std::atomic<MessageChannelBase*>& chan : m_channels) {
+		MessageChannelBase* ptr = chan.load(std::memory_order_acquire);
+		if (ptr) {
+			ptr->dispatch();
 		}
 	}
 }
@@ -2,30 +2,314 @@
 #define MSG_H
 
 #include "types.h"
+#include "mpsc.h"
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <mutex>
 
 NS_BEGIN
 
-class Message {
-	friend class MessageSystem;
+#define MSG_TIMER_SLOTS 256
+#define MSG_TIMER_RESOLUTION (1.0 / 240.0)
+#define MSG_MAX_TYPES 256
+#define MSG_INCOMING_CAPACITY 1024
+
+/// Dense message type ids, handed out on first use of each type (like component ids).
+using MessageID = u32;
+
+inline MessageID nextMessageID() {
+	static std::atomic<MessageID> counter(0);
+	return counter.fetch_add(1);
+}
+
+template <class M>
+MessageID getMessageID() {
+	static const MessageID id = nextMessageID();
+	return id;
+}
+
+/// FIFO over a power-of-two ring of slots. It only allocates when it has to grow, so once
+/// warm, pushing and popping never touch the heap. T must be default constructible.
+template <class T>
+class RingBuffer {
+public:
+	bool empty() const { return m_count == 0; }
+	u32 size() const { return m_count; }
+
+	void push(T&& value) {
+		if (m_count == m_items.size()) {
+			grow();
+		}
+		m_items[(m_head + m_count) & (m_items.size() - 1)] = mov(value);
+		m_count++;
+	}
+
+	T pop() {
+		T value = mov(m_items[m_head]);
+		m_head = (m_head + 1) & (m_items.size() - 1);
+		m_count--;
+		return value;
+	}
+
+private:
+	Vector<T> m_items;
+	u32 m_head{ 0 }, m_count{ 0 };
+
+	void grow() {
+		Vector<T> items(std::max<size_t>(16, m_items.size() * 2));
+		for (u32 i = 0; i < m_count; i++) {
+			items[i] = mov(m_items[(m_head + i) & (m_items.size() - 1)]);
+		}
+		m_items = mov(items);
+		m_head = 0;
+	}
+};
+
+class TimerWheel;
+
+class MessageChannelBase {
 public:
-	Message() : type(""), data(nullptr) {}
-	String type;
-	void *data;
-protected:
-	float time;
+	virtual ~MessageChannelBase() = default;
+	virtual void dispatch() = 0;
+	virtual void unsubscribe(const void* owner) = 0;
+
+	/// Moves what other threads posted into the queue (or the timer wheel). Main thread only.
+	virtual void collect(TimerWheel& timers) = 0;
+
+	/// Queues a message parked by store().
+	virtual void release(u32 handle) = 0;
 };
 
-class IObject {
+/// Hashed timing wheel for delayed messages. Time is cut in ticks of MSG_TIMER_RESOLUTION
+/// seconds, and slot 'i' holds the timers due on ticks congruent to 'i' (counting how many
+/// more turns of the wheel they have to wait). Scheduling is O(1), and advancing only visits
+/// the slots of the ticks that went by.
+class TimerWheel {
 public:
-	virtual void processMessage(const Message& msg) = 0;
+	void schedule(float delay, MessageChannelBase* channel, u32 handle) {
+		u64 ticks = std::max<u64>(1, u64(std::ceil(double(delay) / MSG_TIMER_RESOLUTION)));
+		u64 due = m_tick + ticks;
+		m_slots[due % MSG_TIMER_SLOTS].push_back({ channel, handle, u32((ticks - 1) / MSG_TIMER_SLOTS) });
+		m_pending++;
+	}
+
+	/// Moves time forward by 'dt' and releases every timer that came due, in scheduling order.
+	void advance(float dt) {
+		m_time += dt;
+		u64 target = u64(m_time / MSG_TIMER_RESOLUTION);
+		while (m_tick < target) {
+			m_tick++;
+			if (m_pending > 0) expire(m_slots[m_tick % MSG_TIMER_SLOTS]);
+		}
+	}
+
+	u32 pending() const { return m_pending; }
+
+private:
+	struct Timer {
+		MessageChannelBase* channel;
+		u32 handle;
+		u32 rounds;
+	};
+
+	Array<Vector<Timer>, MSG_TIMER_SLOTS> m_slots;
+	u64 m_tick{ 0 };
+	double m_time{ 0.0 };
+	u32 m_pending{ 0 };
+
+	void expire(Vector<Timer>& slot) {
+		u32 kept = 0;
+		for (u32 i = 0; i < slot.size(); i++) {
+			Timer timer = slot[i];
+			if (timer.rounds == 0) {
+				timer.channel->release(timer.handle);
+				m_pending--;
+			} else {
+				timer.rounds--;
+				slot[kept++] = timer;
+			}
+		}
+		slot.resize(kept);
+	}
+};
+
+/// Queues and subscribers for one message type. Messages are stored by value.
+/// Posting may happen on any thread: messages land in a lock-free incoming queue (or a locked
+/// overflow list when it is full), which the main thread collects before dispatching.
+template <class M>
+class MessageChannel : public MessageChannelBase {
+public:
+	using Handler = Fn<void(const M&)>;
+
+	MessageChannel() : m_incoming(MSG_INCOMING_CAPACITY) {}
+
+	void subscribe(const void* owner, const Handler& handler) {
+		m_subscribers.push_back({ owner, handler });
+	}
+
+	void subscribeDirect(const void* owner, const Handler& handler) {
+		m_direct.push_back({ owner, handler });
+	}
+
+	void unsubscribe(const void* owner) override {
+		auto byOwner = [owner](const Subscriber& sub) { return sub.owner == owner; };
+		m_subscribers.erase(std::remove_if(m_subscribers.begin(), m_subscribers.end(), byOwner), m_subscribers.end());
+		m_direct.erase(std::remove_if(m_direct.begin(), m_direct.end(), byOwner), m_direct.end());
+
+		// A dispatch in progress skips them from now on
+		for (Subscriber& sub : m_dispatching) {
+			if (sub.owner == owner) sub.active = false;
+		}
+	}
+
+	/// Thread safe. Direct subscribers run right away on the calling thread.
+	void post(const M& msg, float delay) {
+		if (delay <= 0.0f) {
+			for (u32 i = 0; i < m_direct.size(); i++) {
+				m_direct[i].handler(msg);
+			}
+		}
+
+		// Once something overflowed everything follows it there until collected, keeping the order
+		Incoming item{ msg, delay };
+		if (m_hasOverflow.load(std::memory_order_acquire) || !m_incoming.push(mov(item))) {
+			std::lock_guard<std::mutex> lock(m_overflowLock);
+			m_overflow.push_back(mov(item));
+			m_hasOverflow.store(true, std::memory_order_release);
+		}
+	}
+
+	void collect(TimerWheel& timers) override {
+		Incoming item;
+		while (m_incoming.pop(item)) {
+			enqueue(item, timers);
+		}
+
+		if (m_hasOverflow.load(std::memory_order_acquire)) {
+			std::lock_guard<std::mutex> lock(m_overflowLock);
+			for (Incoming& over : m_overflow) {
+				enqueue(over, timers);
+			}
+			m_overflow.clear();
+			m_hasOverflow.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	void release(u32 handle) override {
+		m_queue.push(mov(m_delayed[handle]));
+		m_freeDelayed.push_back(handle);
+	}
+
+	void dispatch() override {
+		if (m_queue.empty()) return;
+
+		// Only what was queued so far, messages posted by the handlers wait for the next call.
+		// Likewise the handlers walk a copy of the subscribers, so they may (un)subscribe:
+		// new ones start with the next call.
+		m_dispatching = m_subscribers;
+		for (u32 n = m_queue.size(); n > 0; n--) {
+			M msg = m_queue.pop();
+			for (u32 i = 0; i < m_dispatching.size(); i++) {
+				if (m_dispatching[i].active) m_dispatching[i].handler(msg);
+			}
+		}
+		m_dispatching.clear();
+	}
+
+private:
+	struct Subscriber {
+		const void* owner;
+		Handler handler;
+		bool active = true;
+	};
+
+	struct Incoming {
+		M msg;
+		float delay;
+	};
+
+	Vector<Subscriber> m_subscribers, m_direct;
+	RingBuffer<M> m_queue;
+
+	// Subscribers of the dispatch in progress
+	Vector<Subscriber> m_dispatching;
+
+	MPSCQueue<Incoming> m_incoming;
+	Vector<Incoming> m_overflow;
+	std::mutex m_overflowLock;
+	std::atomic<bool> m_hasOverflow{ false };
+
+	Vector<M> m_delayed;
+	Vector<u32> m_freeDelayed;
+
+	void enqueue(Incoming& item, TimerWheel& timers) {
+		if (item.delay > 0.0f) {
+			timers.schedule(item.delay, this, store(item.msg));
+		} else {
+			m_queue.push(mov(item.msg));
+		}
+	}
+
+	/// Parks a delayed message until release(), reusing freed slots.
+	u32 store(const M& msg) {
+		if (!m_freeDelayed.empty()) {
+			u32 handle = m_freeDelayed.back();
+			m_freeDelayed.pop_back();
+			m_delayed[handle] = msg;
+			return handle;
+		}
+		m_delayed.push_back(msg);
+		return m_delayed.size() - 1;
+	}
 };
 
+/// Typed message bus. Any copyable, default constructible struct can be a message:
+///
+///     struct WindowResizedMessage { u32 width, height; };
+///     MessageSystem::get().subscribe<WindowResizedMessage>(this, [this](const WindowResizedMessage& msg) { ... });
+///     MessageSystem::get().post(WindowResizedMessage{ 800, 600 });
+///
+/// Each type has its own channel, so a message only reaches the handlers of its type.
+/// Order is kept within a channel for a given posting thread, not across channels. Delayed
+/// messages are parked in their channel and tracked by a TimerWheel.
+///
+/// post() may be called from any thread (job workers included), handlers registered with
+/// subscribe() always run on the main thread inside processQueue(). subscribe(), unsubscribe()
+/// and processQueue() belong to the main thread, and subscriptions should be set up before
+/// other threads start posting.
 class MessageSystem {
 public:
 	MessageSystem() {}
+	~MessageSystem();
 
-	void subscribe(IObject* obj);
-	void submit(const String& type, void* data = nullptr, float delay = 0);
+	template <class M>
+	void subscribe(const void* owner, const Fn<void(const M&)>& handler) {
+		channel<M>().subscribe(owner, handler);
+	}
+
+	/// 'handler' runs synchronously inside post(), on the posting thread, so it must be thread safe.
+	/// Skips the queue entirely, for things like counters and loggers. Delayed posts don't use it.
+	template <class M>
+	void subscribeDirect(const void* owner, const Fn<void(const M&)>& handler) {
+		channel<M>().subscribeDirect(owner, handler);
+	}
+
+	/// Removes every handler registered with 'owner', on all channels.
+	void unsubscribe(const void* owner);
+
+	/// Queues 'msg' for the next processQueue().
+	template <class M>
+	void post(const M& msg) {
+		channel<M>().post(msg, 0.0f);
+	}
+
+	/// Delivers 'msg' in the first processQueue() that happens 'delay' seconds (of its 'dt') from now.
+	template <class M>
+	void post(const M& msg, float delay) {
+		channel<M>().post(msg, delay);
+	}
 
 	void processQueue(float dt);
 
@@ -34,8 +318,26 @@ private:
 	MessageSystem(const MessageSystem&) = delete;
 	MessageSystem& operator =(const MessageSystem&) = delete;
 
-	Queue<uptr<Message>> m_messages;
-	Vector<IObject*> m_subscribers;
+	// Indexed by MessageID, filled in lock-free by whichever thread uses a type first
+	Array<std::atomic<MessageChannelBase*>, MSG_MAX_TYPES> m_channels{};
+	TimerWheel m_timers;
+
+	template <class M>
+	MessageChannel<M>& channel() {
+		MessageID id = getMessageID<M>();
+		assert(id < MSG_MAX_TYPES && "Too many message types, raise MSG_MAX_TYPES");
+
+		MessageChannelBase* chan = m_channels[id].load(std::memory_order_acquire);
+		if (!chan) {
+			MessageChannelBase* created = new MessageChannel<M>();
+			if (m_channels[id].compare_exchange_strong(chan, created, std::memory_order_acq_rel)) {
+				chan = created;
+			} else {
+				delete created;
+			}
+		}
+		return *static_cast<MessageChannel<M>*>(chan);
+	}
 
 	static uptr<MessageSystem> s_ston;
 };
@@ -0,0 +1,247 @@
+#include "snapshot.h"
+#include "ecs.h"
+
+NS_BEGIN
+
+void SnapshotWriter::write(const void* data, u64 size) {
+	const u8* bytes = static_cast<const u8*>(data);
+	m_data.insert(m_data.end(), bytes, bytes + size);
+}
+
+void SnapshotWriter::writeString(const String& str) {
+	write(u32(str.size()));
+	write(str.data(), str.size());
+}
+
+bool SnapshotReader::read(void* out, u64 size) {
+	const u8* bytes = skip(size);
+	if (!bytes) {
+		std::memset(out, 0, size);
+		return false;
+	}
+	std::memcpy(out, bytes, size);
+	return true;
+}
+
+String SnapshotReader::readString() {
+	u32 len = read<u32>();
+	const u8* bytes = skip(len);
+	return bytes ? String(reinterpret_cast<const char*>(bytes), len) : String();
+}
+
+const u8* SnapshotReader::skip(u64 size) {
+	if (m_failed || size > m_size - m_pos) {
+		m_failed = true;
+		return nullptr;
+	}
+	const u8* ret = m_data + m_pos;
+	m_pos += size;
+	return ret;
+}
+
+u64 SnapshotReader::remap(u64 id) const {
+	if (!m_remap) return ECS_INVALID_ENTITY;
+	auto found = m_remap->find(id);
+	return found == m_remap->end() ? ECS_INVALID_ENTITY : found->second;
+}
+
+/*
+ * Layout (little endian, as written by the host):
+ *   u32 magic, u32 format, u32 typeCount, u32 blockCount
+ *   typeCount x { string name, u32 version }
+ *   blockCount x {
+ *     u32 rows, u32 columns, columns x u32 type
+ *     u64 bytes, rows x { u64 id, string name }
+ *     columns x { u64 bytes, component data }
+ *   }
+ */
+Vector<u8> EntityWorld::saveSnapshot() {
+	SnapshotWriter out;
+
+	Vector<ComponentSerializer*> types;
+	Array<u32, ECS_MAX_COMPONENTS> typeRef;
+	for (ComponentID id = 0; id < ECS_MAX_COMPONENTS; id++) {
+		if (m_serializers[id]) {
+			typeRef[id] = types.size();
+			types.push_back(m_serializers[id].get());
+		}
+	}
+
+	u32 blockCount = 0;
+	for (uptr<Archetype>& arch : m_archetypes) {
+		if (!arch->empty()) blockCount++;
+	}
+
+	out.write(u32(SNAPSHOT_MAGIC));
+	out.write(u32(SNAPSHOT_FORMAT_VERSION));
+	out.write(u32(types.size()));
+	out.write(blockCount);
+	for (ComponentSerializer* ser : types) {
+		out.writeString(ser->name);
+		out.write(ser->version);
+	}
+
+	for (uptr<Archetype>& arch : m_archetypes) {
+		if (arch->empty()) continue;
+
+		Vector<ComponentArrayBase*> columns;
+		for (const uptr<ComponentArrayBase>& col : arch->columns()) {
+			if (m_serializers[col->id()]) columns.push_back(col.get());
+		}
+
+		out.write(arch->size());
+		out.write(u32(columns.size()));
+		for (ComponentArrayBase* col : columns) {
+			out.write(typeRef[col->id()]);
+		}
+
+		u64 sizeAt = out.placeholder<u64>();
+		u64 start = out.size();
+		for (Entity* ent : arch->entities()) {
+			out.write(ent->id());
+			out.writeString(ent->m_name);
+		}
+		out.patch(sizeAt, out.size() - start);
+
+		for (ComponentArrayBase* col : columns) {
+			sizeAt = out.placeholder<u64>();
+			start = out.size();
+			m_serializers[col->id()]->save(out, *col);
+			out.patch(sizeAt, out.size() - start);
+		}
+	}
+
+	return out.release();
+}
+
+bool EntityWorld::loadSnapshot(const u8* data, u64 size) {
+	SnapshotReader in(data, size);
+	if (in.read<u32>() != SNAPSHOT_MAGIC || in.read<u32>() != SNAPSHOT_FORMAT_VERSION) {
+		return false;
+	}
+
+	struct SavedType {
+		ComponentSerializer* serializer{ nullptr };
+		u32 version{ 0 };
+	};
+
+	struct Column {
+		ComponentSerializer* serializer{ nullptr };
+		u32 version{ 0 };
+		const u8* data{ nullptr };
+		u64 size{ 0 };
+	};
+
+	struct Block {
+		u32 rows{ 0 };
+		Vector<Column> columns;
+		const u8* entities{ nullptr };
+		u64 entitiesSize{ 0 };
+		Archetype* archetype{ nullptr };
+	};
+
+	u32 typeCount = in.read<u32>();
+	u32 blockCount = in.read<u32>();
+
+	Vector<SavedType> types;
+	for (u32 i = 0; i < typeCount && !in.failed(); i++) {
+		String name = in.readString();
+		u32 version = in.read<u32>();
+
+		ComponentSerializer* found = nullptr;
+		for (uptr<ComponentSerializer>& ser : m_serializers) {
+			if (ser && ser->name == name) {
+				found = ser.get();
+				break;
+			}
+		}
+		types.push_back({ found, version });
+	}
+
+	// Validate the whole layout before anything is added to the world
+	Vector<Block> blocks;
+	for (u32 b = 0; b < blockCount && !in.failed(); b++) {
+		Block block;
+		block.rows = in.read<u32>();
+		u32 columnCount = in.read<u32>();
+
+		Vector<u32> refs;
+		for (u32 c = 0; c < columnCount && !in.failed(); c++) {
+			refs.push_back(in.read<u32>());
+		}
+
+		block.entitiesSize = in.read<u64>();
+		block.entities = in.skip(block.entitiesSize);
+		if (in.failed()) return false;
+
+		// Each entity record takes at least its u64 id and the u32 length of its name
+		if (u64(block.rows) * 12 > block.entitiesSize) return false;
+
+		SnapshotReader ents(block.entities, block.entitiesSize);
+		for (u32 i = 0; i < block.rows && !ents.failed(); i++) {
+			ents.read<u64>();
+			ents.skip(ents.read<u32>());
+		}
+		if (ents.failed()) return false;
+
+		for (u32 ref : refs) {
+			u64 bytes = in.read<u64>();
+			const u8* col = in.skip(bytes);
+			if (ref >= types.size()) return false;
+
+			ComponentSerializer* ser = types[ref].serializer;
+			for (Column& other : block.columns) {
+				if (other.serializer == ser) return false;
+			}
+			if (ser) {
+				block.columns.push_back({ ser, types[ref].version, col, bytes });
+			}
+		}
+		blocks.push_back(mov(block));
+	}
+	if (in.failed()) {
+		return false;
+	}
+
+	// Entities go straight into their final archetype, then the columns are filled in
+	UMap<u64, u64> remap;
+	remap.reserve(size / 16);
+	Vector<u64> created;
+	for (Block& block : blocks) {
+		Archetype* arch = rootArchetype();
+		for (Column& col : block.columns) {
+			arch = archetypeAdd(arch, col.serializer->id, col.serializer->factory);
+		}
+		block.archetype = arch;
+		arch->m_entities.reserve(arch->size() + block.rows);
+
+		SnapshotReader ents(block.entities, block.entitiesSize);
+		for (u32 i = 0; i < block.rows; i++) {
+			u64 id = ents.read<u64>();
+			Entity& ent = createIn(arch, ents.readString());
+			remap[id] = ent.id();
+			created.push_back(ent.id());
+		}
+	}
+
+	// Every column must end up with one component per row, even if its data is short
+	bool ok = true;
+	for (Block& block : blocks) {
+		for (Column& col : block.columns) {
+			SnapshotReader reader(col.data, col.size);
+			reader.m_remap = &remap;
+			col.serializer->load(reader, *block.archetype->column(col.serializer->id), block.rows, col.version);
+			ok = ok && !reader.failed();
+		}
+	}
+
+	// Bad component data, the world goes back to how it was. The systems never heard of these.
+	if (!ok) {
+		for (u64 id : created) {
+			destroyEntity(*getEntity(id));
+		}
+	}
+	return ok;
+}
+
+NS_END
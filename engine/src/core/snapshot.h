@@ -0,0 +1,86 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "types.h"
+
+#include <cstring>
+#include <type_traits>
+
+NS_BEGIN
+
+#define SNAPSHOT_MAGIC 0x504E5345 // "ESNP"
+#define SNAPSHOT_FORMAT_VERSION 1
+
+/// Growing byte buffer the world snapshot (and the component serializers) write into.
+class SnapshotWriter {
+public:
+	template <class T>
+	void write(const T& value) {
+		static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be written raw.");
+		write(&value, sizeof(T));
+	}
+
+	void write(const void* data, u64 size);
+	void writeString(const String& str);
+
+	/// Leaves room for a T, to be filled in later with patch().
+	template <class T>
+	u64 placeholder() {
+		u64 at = m_data.size();
+		m_data.resize(at + sizeof(T));
+		return at;
+	}
+
+	template <class T>
+	void patch(u64 at, const T& value) {
+		std::memcpy(m_data.data() + at, &value, sizeof(T));
+	}
+
+	u64 size() const { return m_data.size(); }
+	Vector<u8> release() { return mov(m_data); }
+
+private:
+	Vector<u8> m_data;
+};
+
+/// Bounds-checked cursor over snapshot bytes. The bytes are never copied, so they can come
+/// straight from a memory-mapped file. Reading past the end yields zeros and sets failed().
+class SnapshotReader {
+	friend class EntityWorld;
+public:
+	SnapshotReader(const u8* data, u64 size)
+		: m_data(data), m_size(size), m_pos(0), m_failed(false), m_remap(nullptr)
+	{}
+
+	template <class T>
+	T read() {
+		static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be read raw.");
+		T value{};
+		read(&value, sizeof(T));
+		return value;
+	}
+
+	bool read(void* out, u64 size);
+	String readString();
+
+	/// Returns the next 'size' bytes in place and moves past them, nullptr if there aren't enough.
+	const u8* skip(u64 size);
+
+	/// Translates an entity id stored in the snapshot to the id of the entity it was loaded as.
+	/// Only available while components are being loaded, unknown ids map to 0.
+	u64 remap(u64 id) const;
+
+	u64 remaining() const { return m_size - m_pos; }
+	bool failed() const { return m_failed; }
+
+private:
+	const u8* m_data;
+	u64 m_size, m_pos;
+	bool m_failed;
+
+	const UMap<u64, u64>* m_remap;
+};
+
+NS_END
+
+#endif // SNAPSHOT_H
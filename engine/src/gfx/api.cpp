@@ -25,6 +25,18 @@ VertexBuffer& VertexBuffer::unbind() {
 	return *this;
 }
 
+VertexBuffer& VertexBuffer::allocate(u32 bytes, api::BufferUsage usage) {
+	glBufferData(m_type, bytes, nullptr, usage);
+	m_size = bytes;
+	m_usage = usage;
+	return *this;
+}
+
+VertexBuffer& VertexBuffer::bindBase(u32 index) {
+	glBindBufferBase(m_type, index, m_id);
+	return *this;
+}
+
 VertexBuffer& VertexBuffer::addVertexAttrib(u32 index, u32 size, api::DataType type, bool normalized, u32 stride, u32 offset) {
 	glEnableVertexAttribArray(index);
 	glVertexAttribPointer(index, size, type, normalized, stride, (void*)(offset));
@@ -36,11 +48,11 @@ VertexBuffer& VertexBuffer::setAttribDivisor(u32 index, u32 divisor) {
 	return *this;
 }
 
-void VertexArray::bind() {
+void VertexArray::bind() const {
 	glBindVertexArray(m_id);
 }
 
-void VertexArray::unbind() {
+void VertexArray::unbind() const {
 	glBindVertexArray(0);
 }
 
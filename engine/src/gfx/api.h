@@ -191,6 +191,13 @@ public:
 	VertexBuffer& bind(api::BufferType type);
 	VertexBuffer& unbind();
 
+	/// Reserves `bytes` of uninitialized storage, later filled with setData<u8>. Uniform blocks use it
+	/// so the buffer always covers the whole block, even before the first upload.
+	VertexBuffer& allocate(u32 bytes, api::BufferUsage usage);
+
+	/// Binds the buffer to an indexed binding point of its target (uniform block bindings)
+	VertexBuffer& bindBase(u32 index);
+
 	template <typename T>
 	VertexBuffer& setData(u32 count, T* data, api::BufferUsage usage = api::BufferUsage::Static, u32 offset = 0) {
 		if (m_size < count) {
@@ -246,8 +253,8 @@ public:
 	VertexArray() : m_id(0) {}
 	VertexArray(GLuint id) : m_id(id) {}
 
-	void bind();
-	void unbind();
+	void bind() const;
+	void unbind() const;
 
 	GLuint id() const { return m_id; }
 
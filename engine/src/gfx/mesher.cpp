@@ -6,20 +6,20 @@
 
 NS_BEGIN
 
-void Mesh::bind() {
+void Mesh::bind() const {
 	m_vao.bind();
 }
 
-void Mesh::unbind() {
+void Mesh::unbind() const {
 	m_vao.unbind();
 }
 
-void Mesh::drawIndexed(PrimitiveType primitive, u32 start, u32 count) {
+void Mesh::drawIndexed(PrimitiveType primitive, u32 start, u32 count) const {
 	u32 c = count == 0 ? indexCount() : count;
 	glDrawElements(primitive, c, GL_UNSIGNED_INT, (void*)(start * sizeof(i32)));
 }
 
-void Mesh::drawIndexedInstanced(PrimitiveType primitive, u32 instances, u32 start, u32 count) {
+void Mesh::drawIndexedInstanced(PrimitiveType primitive, u32 instances, u32 start, u32 count) const {
 	u32 c = count == 0 ? indexCount() : count;
 	glDrawElementsInstanced(primitive, c, GL_UNSIGNED_INT, (void*)(start * sizeof(i32)), instances);
 }
@@ -66,7 +66,7 @@ void Mesh::flush() {
 
 	// Compute bounding box
 	Vec3 aabbMin = Vec3(FLT_MAX);
-	Vec3 aabbMax = Vec3(FLT_MIN);
+	Vec3 aabbMax = Vec3(-FLT_MAX);
 	for (Vertex v : m_vertexData) {
 		aabbMin.x = std::min(aabbMin.x, v.position.x);
 		aabbMin.y = std::min(aabbMin.y, v.position.y);
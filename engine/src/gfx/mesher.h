@@ -85,11 +85,11 @@ public:
 
 	void flush();
 
-	void bind();
-	void unbind();
+	void bind() const;
+	void unbind() const;
 
-	void drawIndexed(PrimitiveType primitive, u32 start = 0, u32 count = 0);
-	void drawIndexedInstanced(PrimitiveType primitive, u32 instances, u32 start = 0, u32 count = 0);
+	void drawIndexed(PrimitiveType primitive, u32 start = 0, u32 count = 0) const;
+	void drawIndexedInstanced(PrimitiveType primitive, u32 instances, u32 start = 0, u32 count = 0) const;
 
 	u8* map();
 	void unmap();
@@ -104,6 +104,9 @@ public:
 
 	AABB aabb() const { return m_aabb; }
 
+	/// Vertex array name, tells meshes apart on the GPU side.
+	GLuint id() const { return m_vao.id(); }
+
 	bool valid() const {
 		return m_vbo.id() != 0 && m_vao.id() != 0 && m_ibo.id() != 0 && m_vertexCount > 0 && m_indexCount > 0;
 	}
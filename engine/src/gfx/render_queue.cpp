@@ -0,0 +1,58 @@
+#include "render_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+NS_BEGIN
+
+u64 RenderQueue::makeKey(RenderPass pass, u32 shader, u32 material, u32 textures, u32 mesh, float depth) {
+	// The bits of a non-negative float sort like the float itself, the top 16 keep sign, exponent
+	// and 7 bits of mantissa, plenty to order draws front to back
+	u32 depthBits;
+	depth = std::max(depth, 0.0f);
+	std::memcpy(&depthBits, &depth, sizeof(float));
+
+	return (u64(u32(pass) & 0xF) << 60) |
+		(u64(shader & 0xFF) << 52) |
+		(u64(material & 0xFFF) << 40) |
+		(u64(textures & 0xFFF) << 28) |
+		(u64(mesh & 0xFFF) << 16) |
+		u64(depthBits >> 16);
+}
+
+void RenderQueue::sort() {
+	const u32 count = m_items.size();
+	if (count < 2) return;
+
+	m_scratch.resize(count);
+	Item* src = m_items.data();
+	Item* dst = m_scratch.data();
+
+	for (u32 shift = 0; shift < 64; shift += 8) {
+		u32 offsets[256] = { 0 };
+		for (u32 i = 0; i < count; i++) {
+			offsets[(src[i].key >> shift) & 0xFF]++;
+		}
+
+		// Every key has the same byte here, the order wouldn't change
+		if (offsets[(src[0].key >> shift) & 0xFF] == count) continue;
+
+		u32 sum = 0;
+		for (u32& offset : offsets) {
+			u32 n = offset;
+			offset = sum;
+			sum += n;
+		}
+
+		for (u32 i = 0; i < count; i++) {
+			dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+		}
+		std::swap(src, dst);
+	}
+
+	if (src != m_items.data()) {
+		m_items.swap(m_scratch);
+	}
+}
+
+NS_END
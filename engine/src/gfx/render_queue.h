@@ -0,0 +1,43 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "../core/types.h"
+
+NS_BEGIN
+
+enum class RenderPass {
+	GBuffer = 0,
+	Shadow
+};
+
+/// Draws of one pass, sorted by a packed state key so consecutive draws share as much GPU
+/// state as possible. From the most significant bits down:
+///   pass (4) | shader (8) | material (12) | texture set (12) | mesh (12) | depth (16)
+/// Fields wider than their bits are wrapped, which only makes the sort a bit less effective.
+class RenderQueue {
+public:
+	struct Item {
+		u64 key;
+		u32 index; ///< Index of the draw in the caller's list
+	};
+
+	static u64 makeKey(RenderPass pass, u32 shader, u32 material, u32 textures, u32 mesh, float depth);
+
+	void clear() { m_items.clear(); }
+	void reserve(u32 count) { m_items.reserve(count); }
+	void push(u64 key, u32 index) { m_items.push_back({ key, index }); }
+
+	/// LSD radix sort on the key, one byte per pass. Bytes that are the same in every key are skipped.
+	void sort();
+
+	const Vector<Item>& items() const { return m_items; }
+	u32 size() const { return m_items.size(); }
+	bool empty() const { return m_items.empty(); }
+
+private:
+	Vector<Item> m_items, m_scratch;
+};
+
+NS_END
+
+#endif // RENDER_QUEUE_H
@@ -65,6 +65,14 @@ bool ShaderProgram::has(const String& name) {
 	return getUniformLocation(name) != -1;
 }
 
+bool ShaderProgram::bindBlock(const String& name, u32 binding) {
+	if (!m_valid) return false;
+	GLuint index = glGetUniformBlockIndex(m_program, name.c_str());
+	if (index == GL_INVALID_INDEX) return false;
+	glUniformBlockBinding(m_program, index, binding);
+	return true;
+}
+
 ShaderProgram& ShaderProgram::add(const String& source, ShaderType type) {
 	const char *c_str = source.c_str();
 	GLuint s = GLShader::create(type);
@@ -27,19 +27,23 @@ struct UniformValue {
 	} value;
 };
 
+/// Handle to a uniform of a linked program, valid until it's linked again. Setting one that
+/// wasn't found in the program does nothing, the default constructed one included.
 class Uniform {
 	friend class ShaderProgram;
 public:
-	void set(u64 v) { glUniform(1ui, v); }
-	void set(i32 v) { glUniform(1i, v); }
-	void set(float v) { glUniform(1f, v); }
-	void set(bool v) { glUniform(1i, v ? 1 : 0); }
-	void set(Vec2 v) { glUniform(2f, v.x, v.y); }
-	void set(Vec3 v) { glUniform(3f, v.x, v.y, v.z); }
-	void set(Vec4 v) { glUniform(4f, v.x, v.y, v.z, v.w); }
-	void set(Mat4 v) { glUniform(Matrix4fv, 1, false, glm::value_ptr(v)); }
-
-	void set(const Mat4* v, u32 size) {
+	Uniform() : location(-1), m_type(0) {}
+
+	void set(u64 v) const { glUniform(1ui, v); }
+	void set(i32 v) const { glUniform(1i, v); }
+	void set(float v) const { glUniform(1f, v); }
+	void set(bool v) const { glUniform(1i, v ? 1 : 0); }
+	void set(Vec2 v) const { glUniform(2f, v.x, v.y); }
+	void set(Vec3 v) const { glUniform(3f, v.x, v.y, v.z); }
+	void set(Vec4 v) const { glUniform(4f, v.x, v.y, v.z, v.w); }
+	void set(Mat4 v) const { glUniform(Matrix4fv, 1, false, glm::value_ptr(v)); }
+
+	void set(const Mat4* v, u32 size) const {
 		Vector<float> mv; mv.reserve(size * 16);
 		for (u32 i = 0; i < size; i++) {
 			const float* mval = glm::value_ptr(v[i]);
@@ -48,7 +52,7 @@ public:
 		glUniform(Matrix4fv, size, false, mv.data());
 	}
 
-	void set(const Vector<Mat4>& v) {
+	void set(const Vector<Mat4>& v) const {
 		Vector<float> mv; mv.reserve(v.size() * 16);
 		for (Mat4 m : v) {
 			const float* mval = glm::value_ptr(m);
@@ -60,6 +64,8 @@ public:
 	GLenum type() const { return m_type; }
 	String name() const { return m_name; }
 
+	bool valid() const { return location != -1; }
+
 protected:
 	i32 location;
 	GLenum m_type;
@@ -82,10 +88,16 @@ public:
 	i32 getAttributeLocation(const String& name);
 	i32 getUniformLocation(const String& name);
 
+	/// Looks the uniform up by name. Code that sets it often (like once per draw) should keep the
+	/// returned handle instead.
 	Uniform get(const String& name);
 	UniformValue& getValue(const String& name);
 
 	bool has(const String& name);
+
+	/// Points the uniform block `name` at a buffer binding index (see VertexBuffer::bindBase).
+	/// Returns false if the program has no such active block.
+	bool bindBlock(const String& name, u32 binding);
 	Map<String, i32> uniforms() const { return m_uniforms; }
 
 	bool valid() const { return m_valid; }
@@ -0,0 +1,55 @@
+#ifndef STD140_H
+#define STD140_H
+
+#include "../core/types.h"
+#include "../math/vec.h"
+#include "../math/mat.h"
+
+#include <cstring>
+
+NS_BEGIN
+
+/// Packs values in the order a `layout (std140)` uniform block declares them, padding like GLSL does:
+/// scalars align to 4, vec2 to 8, vec3/vec4 and the columns of a mat4 to 16, and structs start and
+/// end on 16. An array of structs is just its elements one after the other, each between
+/// beginStruct()/endStruct(). clear() keeps the memory, so a writer can be refilled every frame.
+class Std140Writer {
+public:
+	Std140Writer& put(float v) { return write(&v, 4, 4); }
+	Std140Writer& put(i32 v) { return write(&v, 4, 4); }
+	Std140Writer& put(u32 v) { return write(&v, 4, 4); }
+	Std140Writer& put(bool v) { u32 b = v ? 1 : 0; return write(&b, 4, 4); }
+	Std140Writer& put(const Vec2& v) { return write(glm::value_ptr(v), 8, 8); }
+	Std140Writer& put(const Vec3& v) { return write(glm::value_ptr(v), 12, 16); }
+	Std140Writer& put(const Vec4& v) { return write(glm::value_ptr(v), 16, 16); }
+	Std140Writer& put(const Mat4& v) { return write(glm::value_ptr(v), 64, 16); }
+
+	Std140Writer& beginStruct() { align(16); return *this; }
+	Std140Writer& endStruct() { align(16); return *this; }
+
+	/// Pads with zeros up to the next multiple of `alignment`
+	void align(u32 alignment) {
+		const u32 size = m_data.size();
+		m_data.resize((size + alignment - 1) / alignment * alignment, 0);
+	}
+
+	void clear() { m_data.clear(); }
+
+	const u8* data() const { return m_data.data(); }
+	u32 size() const { return m_data.size(); }
+
+private:
+	Vector<u8> m_data;
+
+	Std140Writer& write(const void* value, u32 size, u32 alignment) {
+		align(alignment);
+		const u32 at = m_data.size();
+		m_data.resize(at + size);
+		std::memcpy(m_data.data() + at, value, size);
+		return *this;
+	}
+};
+
+NS_END
+
+#endif // STD140_H
@@ -243,7 +243,7 @@ Texture& Texture::bind(TextureTarget target) {
 	return *this;
 }
 
-void Texture::bind(const Sampler& sampler, u32 slot) {
+void Texture::bind(const Sampler& sampler, u32 slot) const {
 	glActiveTexture(GL_TEXTURE0 + slot);
 	glBindTexture(m_target, m_id);
 	sampler.bind(slot);
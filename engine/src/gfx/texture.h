@@ -37,6 +37,8 @@ public:
 	void bind(u32 slot) const { glBindSampler(slot, m_id); }
 	void unbind(u32 slot) const { glBindSampler(slot, 0); }
 
+	GLuint id() const { return m_id; }
+
 protected:
 	GLuint m_id;
 };
@@ -58,7 +60,7 @@ public:
 	Texture& generateMipmaps();
 
 	Texture& bind(TextureTarget target);
-	void bind(const Sampler& sampler, u32 slot = 0);
+	void bind(const Sampler& sampler, u32 slot = 0) const;
 	void unbind();
 
 	TextureTarget target() const { return m_target; }
@@ -6,6 +6,8 @@
 
 #include "systems/renderer.h"
 #include "systems/physics_system.h"
+#include "systems/transform_system.h"
+#include "systems/spatial_system.h"
 
 #include "core/ecs.h"
 #include "core/input.h"
@@ -30,15 +32,18 @@
 
 #include <cmath>
 
-void drawTransformEditor(Transform& t) {
-	ImGui::InputFloat3("Tr", glm::value_ptr(t.position), 4);
+/// Returns whether anything was edited.
+bool drawTransformEditor(Transform& t) {
+	bool edited = ImGui::InputFloat3("Tr", glm::value_ptr(t.position), 4);
 
 	Vec3 euler = glm::eulerAngles(t.rotation);
 	if (ImGui::InputFloat3("Rt", glm::value_ptr(euler), 4)) {
 		t.rotation = glm::quat(euler);
+		edited = true;
 	}
 
-	ImGui::InputFloat3("Sc", glm::value_ptr(t.scale), 4);
+	edited |= ImGui::InputFloat3("Sc", glm::value_ptr(t.scale), 4);
+	return edited;
 }
 
 void drawCameraEditor(Camera& t) {
@@ -338,6 +343,9 @@ public:
 					.addColorAttachment(TextureFormat::RGB, TextureTarget::Texture2D);
 
 		psys = &eworld.registerSystem<PhysicsSystem>();
+		tsys = &eworld.registerSystem<TransformSystem>();
+		spatial = &eworld.registerSystem<SpatialSystem>();
+		editorTransforms = &editorWorld.registerSystem<TransformSystem>();
 
 		Texture envMap = Builder<Texture>::build()
 				.bind(TextureTarget::CubeMap)
@@ -373,8 +381,8 @@ public:
 		model.addFromFile("fcube.obj");
 		model.flush();
 
-		// Default Camera
-		defaultCamera = uptr<Entity>(new Entity());
+		// Default Camera (lives outside the scene so it never gets rendered or picked)
+		defaultCamera = &editorWorld.create("editor_camera");
 		defaultCamera->assign<Camera>(0.02f, 100.0f, glm::radians(45.0f));
 		Transform &dct = defaultCamera->assign<Transform>();
 		dct.position.z = 10.0f;
@@ -398,48 +406,45 @@ public:
 
 		const i32 COUNT = 12;
 		const i32 COUNT_1 = COUNT > 1 ? COUNT-1 : 1;
-		for (i32 i = 0; i < COUNT; i++) {
-			float fact = float(i) / float(COUNT_1);
-
-			Entity& mod1 = eworld.create(Util::strCat("box_", i));
-			mod1.assign<Drawable3D>(model, def.id());
-			mod1.assign<Texturer>();
 
-			Transform& modt = mod1.assign<Transform>();
-			modt.rotate(Vec3(0, 0, 1), glm::radians(180.0f));
-			modt.rotate(Vec3(0, 1, 0), glm::radians(45.0f));
-			modt.position = Vec3((fact * 2.0f - 1.0f) * COUNT * 1.6f, 1.2f, 0);
+		Transform boxt;
+		boxt.rotate(Vec3(0, 0, 1), glm::radians(180.0f));
+		boxt.rotate(Vec3(0, 1, 0), glm::radians(45.0f));
 
-			mod1.assign<CollisionShape>(sw);
-			mod1.assign<RigidBody>(2.0f);
-		}
+		Prefab box(Drawable3D(model, def.id()), Texturer(), boxt, CollisionShape(sw), RigidBody(2.0f));
+		eworld.instantiate(box, COUNT, [&](Entity& ent, u32 i) {
+			float fact = float(i) / float(COUNT_1);
+			ent.setName(Util::strCat("box_", i));
+			ent.get<Transform>()->position = Vec3((fact * 2.0f - 1.0f) * COUNT * 1.6f, 1.2f, 0);
+		});
 
 		// Lights
 		Entity& s0 = eworld.create("dir_light0");
 		Transform& s0t = s0.assign<Transform>();
-		DirectionalLight& s0p = s0.assign<DirectionalLight>();
-
 		s0t.position = Vec3(0.0f, 4.0f, 4.0f);
 		s0t.rotate(Vec3(1, 0, 0), glm::radians(45.0f));
+
+		// Assigning moves the entity to another archetype, so the light is assigned last
+		DirectionalLight& s0p = s0.assign<DirectionalLight>();
 		s0p.intensity = 1.0f;
 		s0p.shadows = true;
 		s0p.shadowFrustumSize = 20.0f;
 
 		Entity& s1 = eworld.create("spot_light0");
 		Transform& s1t = s1.assign<Transform>();
-		SpotLight& s1p = s1.assign<SpotLight>();
-
 		s1t.position = Vec3(-4.0f, 4.0f, 4.0f);
 		s1t.rotate(Vec3(1, 0, 0), glm::radians(45.0f));
+
+		SpotLight& s1p = s1.assign<SpotLight>();
 		s1p.intensity = 1.0f;
 		s1p.shadows = true;
 		s1p.spotCutOff = glm::radians(30.0f);
 
 		Entity& s2 = eworld.create("point_light0");
 		Transform& s2t = s2.assign<Transform>();
-		PointLight& s2p = s2.assign<PointLight>();
-
 		s2t.position = Vec3(4.0f, 4.0f, 4.0f);
+
+		PointLight& s2p = s2.assign<PointLight>();
 		s2p.intensity = 1.0f;
 		s2p.radius = 5.0f;
 
@@ -466,16 +471,16 @@ public:
 						e
 			);
 
-			// Reconstruct entity ID
-			u64 eid = ((e[0] & 0xFF) << 16) | ((e[1] & 0xFF) << 8) | (e[2] & 0xFF);
-			selected = eworld.getEntity(eid);
+			// Reconstruct entity slot index
+			u32 eidx = ((e[0] & 0xFF) << 16) | ((e[1] & 0xFF) << 8) | (e[2] & 0xFF);
+			selected = eworld.entityAt(eidx);
 
 			rsys->pickingBuffer().unbind();
 		}
 
 		if (Input::isKeyPressed(SDLK_SPACE)) {
 			if (selected) {
-				Transform* t = defaultCamera->get<Transform>();
+				Transform* t = defaultCamera->modify<Transform>();
 				Vec3 vec = t->position - cameraPivot;
 
 				cameraPivot = selected->get<Transform>()->worldPosition();
@@ -506,7 +511,7 @@ public:
 
 			Vec2 delta = (curr - prevMp) * sensitivity;
 
-			Transform* t = defaultCamera->get<Transform>();
+			Transform* t = defaultCamera->modify<Transform>();
 
 			if (Input::isKeyDown(SDLK_LSHIFT) || Input::isKeyDown(SDLK_RSHIFT)) {
 				Vec3 dirX = t->right();
@@ -543,7 +548,7 @@ public:
 
 		i32 scr = Input::getScrollOffset();
 		if (std::abs(scr) > 0 && mouseLocked) {
-			Transform* cam = defaultCamera->get<Transform>();
+			Transform* cam = defaultCamera->modify<Transform>();
 			float fac = -0.4f * float(scr);
 			Vec3 vec = cam->position - cameraPivot;
 			Vec3 dir = glm::normalize(vec);
@@ -551,9 +556,14 @@ public:
 			cam->position += fac * dir;
 		}
 
+		// The editor world is never updated, only its camera moves
+		editorTransforms->refresh(editorWorld);
+
 		if (playing) {
 			eworld.update(timeDelta);
 		} else {
+			tsys->refresh(eworld);
+			spatial->refresh(eworld);
 			eworld.each([&](Entity& ent, Transform& t, RigidBody& b) {
 				Vec3 pos = t.worldPosition();
 				Quat rot = t.worldRotation();
@@ -588,7 +598,7 @@ public:
 		if (ImGui::BeginMainMenuBar()) {
 			if (ImGui::BeginMenu("File")) {
 				if (ImGui::MenuItem("Exit", "CTRL+Q")) {
-					MessageSystem::get().submit("app_quit");
+					MessageSystem::get().post(AppQuitMessage());
 				}
 				ImGui::EndMenu();
 			}
@@ -681,7 +691,7 @@ public:
 					editTransform(
 							viewMat,
 							projMat,
-							*selected->get<Transform>(),
+							*selected->modify<Transform>(),
 							aabb,
 							viewportX, viewportY, viewportW, viewportH
 					);
@@ -699,6 +709,13 @@ public:
 
 			ImVec2 sz(outW, outH);
 
+			ImGui::Text("Objects: %u", sceneStats.objects);
+			ImGui::Text("Visible: %u (culled %u)", sceneStats.visible, sceneStats.culled);
+			ImGui::Text("Shadow casters: %u (culled %u)", sceneStats.shadowVisible, sceneStats.shadowCulled);
+			ImGui::Text("Draw calls: %u", sceneStats.drawCalls);
+			ImGui::Text("Binds: %u meshes, %u materials, %u texture sets",
+						sceneStats.meshBinds, sceneStats.materialBinds, sceneStats.textureBinds);
+
 			ImGui::Text("Normals");
 			ImGui::Image(
 						(ImTextureID)rsys->GBuffer().getColorAttachment(0).id(),
@@ -745,27 +762,28 @@ public:
 				}
 			}
 			ImGui::Separator();
-			for (uptr<Entity>& e : eworld.entities()) {
+			for (Entity* e : eworld.entities()) {
 				u64 id = e->id();
-				String title = e->name().empty() ? Util::strCat("ent_", id) : e->name();
+				String title = e->name().empty() ? Util::strCat("ent_", e->index()) : e->name();
 				bool sel = selected != nullptr && selected->id() == id;
 				if (ImGui::TreeNodeEx(title.c_str(), sel ? ImGuiTreeNodeFlags_Selected : 0)) {
-					for (auto const& [k, v] : e->components()) {
-						if (ImGui::TreeNode(&k, k.name())) {
+					for (auto const& [k, c] : e->components()) {
+						// The type name is the ID, components() is a fresh list every frame
+						if (ImGui::TreeNode(k.name())) {
 							if (k == getTypeIndex<Transform>()) {
-								drawTransformEditor(*((Transform*) v.get()));
+								if (drawTransformEditor(*((Transform*) c))) e->markChanged<Transform>();
 							} else if (k == getTypeIndex<Camera>()) {
-								drawCameraEditor(*((Camera*) v.get()));
+								drawCameraEditor(*((Camera*) c));
 							} else if (k == getTypeIndex<Drawable3D>()) {
-								drawDrawable3DEditor(title, *((Drawable3D*) v.get()), rsys);
+								drawDrawable3DEditor(title, *((Drawable3D*) c), rsys);
 							} else if (k == getTypeIndex<Texturer>()) {
-								drawTexturerEditor(*((Texturer*) v.get()));
+								drawTexturerEditor(*((Texturer*) c));
 							} else if (k == getTypeIndex<DirectionalLight>()) {
-								drawDirectionalLightEditor(*((DirectionalLight*) v.get()));
+								drawDirectionalLightEditor(*((DirectionalLight*) c));
 							} else if (k == getTypeIndex<PointLight>()) {
-								drawPointLightEditor(((PointLight*) v.get()));
+								drawPointLightEditor(((PointLight*) c));
 							} else if (k == getTypeIndex<SpotLight>()) {
-								drawSpotLightEditor(*((SpotLight*) v.get()));
+								drawSpotLightEditor(*((SpotLight*) c));
 							}
 							ImGui::TreePop();
 						}
@@ -773,6 +791,18 @@ public:
 					ImGui::TreePop();
 				}
 			}
+
+			if (ImGui::CollapsingHeader("Component Pools")) {
+				for (const ComponentPoolStats& pool : eworld.poolStats()) {
+					if (ImGui::TreeNode(pool.name.c_str())) {
+						ImGui::Text("Live: %u / %u slots (%.1f%%)", pool.live, pool.capacity, pool.occupancy() * 100.0f);
+						ImGui::Text("Parked: %u blocks, %u slots", pool.freeBlocks, pool.freeCapacity);
+						ImGui::Text("Heap blocks: %u", pool.heapBlocks);
+						ImGui::Text("Fragmentation: %.1f%%", pool.fragmentation() * 100.0f);
+						ImGui::TreePop();
+					}
+				}
+			}
 		}
 		ImGui::EndDock();
 
@@ -829,9 +859,10 @@ public:
 		ImGui::EndDock();
 	}
 
-	void render() {
+	void render(float alpha) {
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		eworld.render(&sceneFbo, defaultCamera.get());
+		eworld.render(&sceneFbo, defaultCamera, alpha);
+		sceneStats = rsys->stats();
 
 		sceneFbo.bind();
 
@@ -1016,9 +1047,9 @@ public:
 		projMat = cam->getProjection(viewportW == 0 ? ww : viewportW, viewportH == 0 ? wh : viewportH);
 		if (defaultCamera->has<Transform>()) {
 			Transform* t = defaultCamera->get<Transform>();
-			Quat qRot = glm::conjugate(t->worldRotation());
+			Quat qRot = glm::conjugate(t->worldRotation(alpha));
 			Mat4 rot = glm::mat4_cast(qRot);
-			Mat4 loc = glm::translate(Mat4(1.0f), t->worldPosition() * -1.0f);
+			Mat4 loc = glm::translate(Mat4(1.0f), t->worldPosition(alpha) * -1.0f);
 			viewMat = rot * loc;
 		}
 		Imm::render(viewMat, projMat);
@@ -1033,7 +1064,7 @@ public:
 	Texture icons;
 
 	Entity* selected;
-	uptr<Entity> defaultCamera;
+	Entity* defaultCamera;
 	Vec3 cameraPivot, orbitDelta;
 	Vec2 prevMp;
 
@@ -1041,8 +1072,12 @@ public:
 	bool mouseLocked, screenResizing, playing, cameraAnimating;
 
 	RendererSystem* rsys;
+	RenderStats sceneStats;
 	PhysicsSystem* psys;
-	EntityWorld eworld;
+	TransformSystem* tsys;
+	SpatialSystem* spatial;
+	TransformSystem* editorTransforms;
+	EntityWorld eworld, editorWorld;
 	float t;
 
 	FrameBuffer sceneFbo, cameraFbo;
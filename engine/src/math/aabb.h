@@ -2,21 +2,70 @@
 #define AABB_H
 
 #include "vec.h"
+#include "mat.h"
 #include "../core/types.h"
 
 #include <cmath>
 #include <cfloat>
+#include <algorithm>
 
 NS_BEGIN
 
 class AABB {
 public:
-	AABB() : m_min(FLT_MAX), m_max(FLT_MIN) {}
+	AABB() : m_min(FLT_MAX), m_max(-FLT_MAX) {}
 	AABB(const Vec3& min, const Vec3& max) : m_min(min), m_max(max) {}
 	
 	Vec3 min() const { return m_min; }
 	Vec3 max() const { return m_max; }
-	
+
+	/// True for the default constructed box, which merges into anything without growing it.
+	bool empty() const { return m_min.x > m_max.x; }
+
+	Vec3 center() const { return (m_min + m_max) * 0.5f; }
+	Vec3 extent() const { return (m_max - m_min) * 0.5f; }
+
+	/// Half the surface area, enough to compare boxes.
+	float area() const {
+		Vec3 d = m_max - m_min;
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	}
+
+	bool contains(const AABB& o) const {
+		return glm::all(glm::lessThanEqual(m_min, o.m_min)) && glm::all(glm::lessThanEqual(o.m_max, m_max));
+	}
+
+	bool overlaps(const AABB& o) const {
+		return glm::all(glm::lessThanEqual(m_min, o.m_max)) && glm::all(glm::lessThanEqual(o.m_min, m_max));
+	}
+
+	/// Squared distance from 'p' to the box, 0 inside.
+	float distanceSq(const Vec3& p) const {
+		Vec3 d = glm::max(glm::max(m_min - p, p - m_max), Vec3(0.0f));
+		return glm::dot(d, d);
+	}
+
+	/// Distance along the ray where it enters the box (0 from inside), 'invDir' is 1 / direction.
+	bool raycast(const Vec3& origin, const Vec3& invDir, float maxDistance, float& distance) const {
+		Vec3 t0 = (m_min - origin) * invDir, t1 = (m_max - origin) * invDir;
+		Vec3 tmin = glm::min(t0, t1), tmax = glm::max(t0, t1);
+		float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+		float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, maxDistance));
+		distance = enter;
+		return enter <= exit;
+	}
+
+	AABB merged(const AABB& o) const { return AABB(glm::min(m_min, o.m_min), glm::max(m_max, o.m_max)); }
+	AABB expanded(float margin) const { return AABB(m_min - Vec3(margin), m_max + Vec3(margin)); }
+
+	/// Axis aligned box around this one once transformed by 'model'.
+	AABB transformed(const Mat4& model) const {
+		Vec3 c = Vec3(model * Vec4(center(), 1.0f));
+		Vec3 h = extent();
+		Vec3 e = glm::abs(Vec3(model[0])) * h.x + glm::abs(Vec3(model[1])) * h.y + glm::abs(Vec3(model[2])) * h.z;
+		return AABB(c - e, c + e);
+	}
+
 private:
 	Vec3 m_min, m_max;
 };
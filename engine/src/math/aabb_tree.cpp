@@ -0,0 +1,233 @@
+#include "aabb_tree.h"
+
+#include <queue>
+
+NS_BEGIN
+
+i32 AABBTree::insert(const AABB& box, u64 data) {
+	i32 leaf = allocateNode();
+	Node& node = m_nodes[leaf];
+	node.box = box.expanded(m_margin);
+	node.data = data;
+	node.height = 0;
+
+	insertLeaf(leaf);
+	m_leaves++;
+	return leaf;
+}
+
+void AABBTree::remove(i32 proxy) {
+	removeLeaf(proxy);
+	freeNode(proxy);
+	m_leaves--;
+}
+
+bool AABBTree::move(i32 proxy, const AABB& box) {
+	// Shrinking a lot also reinserts, or the fat box would keep matching queries it shouldn't
+	const AABB& fat = m_nodes[proxy].box;
+	if (fat.contains(box) && box.expanded(m_margin * 4.0f).contains(fat)) {
+		return false;
+	}
+
+	removeLeaf(proxy);
+	m_nodes[proxy].box = box.expanded(m_margin);
+	insertLeaf(proxy);
+	return true;
+}
+
+void AABBTree::clear() {
+	m_nodes.clear();
+	m_root = m_free = NULL_NODE;
+	m_leaves = 0;
+}
+
+void AABBTree::nearest(const Vec3& point, u32 k, Vector<i32>& out) const {
+	out.clear();
+	if (m_root == NULL_NODE || k == 0) return;
+
+	// Best first: a child is never closer than its parent, so leaves come out in distance order
+	using Entry = std::pair<float, i32>;
+	std::priority_queue<Entry, Vector<Entry>, std::greater<Entry>> open;
+	open.push({ m_nodes[m_root].box.distanceSq(point), m_root });
+	while (!open.empty()) {
+		i32 id = open.top().second;
+		open.pop();
+
+		const Node& node = m_nodes[id];
+		if (node.leaf()) {
+			out.push_back(id);
+			if (out.size() == k) return;
+		} else {
+			open.push({ m_nodes[node.child1].box.distanceSq(point), node.child1 });
+			open.push({ m_nodes[node.child2].box.distanceSq(point), node.child2 });
+		}
+	}
+}
+
+i32 AABBTree::allocateNode() {
+	i32 id;
+	if (m_free != NULL_NODE) {
+		id = m_free;
+		m_free = m_nodes[id].next;
+	} else {
+		id = m_nodes.size();
+		m_nodes.emplace_back();
+	}
+
+	Node& node = m_nodes[id];
+	node.parent = node.child1 = node.child2 = node.next = NULL_NODE;
+	node.data = 0;
+	node.height = 0;
+	return id;
+}
+
+void AABBTree::freeNode(i32 node) {
+	m_nodes[node].next = m_free;
+	m_nodes[node].height = -1;
+	m_free = node;
+}
+
+void AABBTree::insertLeaf(i32 leaf) {
+	if (m_root == NULL_NODE) {
+		m_root = leaf;
+		m_nodes[leaf].parent = NULL_NODE;
+		return;
+	}
+
+	// Walk down to the cheapest sibling, by how much surface area each choice adds
+	const AABB box = m_nodes[leaf].box;
+	i32 index = m_root;
+	while (!m_nodes[index].leaf()) {
+		const Node& node = m_nodes[index];
+		float area = node.box.area();
+		float combinedArea = node.box.merged(box).area();
+
+		// Pairing with this node, versus pushing the leaf further down which grows this node anyway
+		float cost = 2.0f * combinedArea;
+		float inheritance = 2.0f * (combinedArea - area);
+
+		auto descendCost = [&](i32 child) {
+			const AABB& cbox = m_nodes[child].box;
+			float merged = cbox.merged(box).area();
+			return m_nodes[child].leaf() ? merged + inheritance : merged - cbox.area() + inheritance;
+		};
+		float cost1 = descendCost(node.child1);
+		float cost2 = descendCost(node.child2);
+
+		if (cost < cost1 && cost < cost2) break;
+		index = cost1 < cost2 ? node.child1 : node.child2;
+	}
+
+	const i32 sibling = index;
+	const i32 oldParent = m_nodes[sibling].parent;
+	const i32 newParent = allocateNode();
+
+	Node& parent = m_nodes[newParent];
+	parent.parent = oldParent;
+	parent.box = m_nodes[sibling].box.merged(box);
+	parent.height = m_nodes[sibling].height + 1;
+	parent.child1 = sibling;
+	parent.child2 = leaf;
+	m_nodes[sibling].parent = newParent;
+	m_nodes[leaf].parent = newParent;
+
+	if (oldParent != NULL_NODE) {
+		Node& old = m_nodes[oldParent];
+		if (old.child1 == sibling) old.child1 = newParent;
+		else old.child2 = newParent;
+	} else {
+		m_root = newParent;
+	}
+
+	fixUpwards(m_nodes[leaf].parent);
+}
+
+void AABBTree::removeLeaf(i32 leaf) {
+	if (leaf == m_root) {
+		m_root = NULL_NODE;
+		return;
+	}
+
+	const i32 parent = m_nodes[leaf].parent;
+	const i32 grandParent = m_nodes[parent].parent;
+	const i32 sibling = m_nodes[parent].child1 == leaf ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+	// The sibling takes the parent's place
+	m_nodes[sibling].parent = grandParent;
+	if (grandParent != NULL_NODE) {
+		Node& grand = m_nodes[grandParent];
+		if (grand.child1 == parent) grand.child1 = sibling;
+		else grand.child2 = sibling;
+	} else {
+		m_root = sibling;
+	}
+	freeNode(parent);
+	m_nodes[leaf].parent = NULL_NODE;
+
+	fixUpwards(grandParent);
+}
+
+void AABBTree::fixUpwards(i32 node) {
+	while (node != NULL_NODE) {
+		node = balance(node);
+
+		Node& n = m_nodes[node];
+		const Node& c1 = m_nodes[n.child1];
+		const Node& c2 = m_nodes[n.child2];
+		n.height = 1 + std::max(c1.height, c2.height);
+		n.box = c1.box.merged(c2.box);
+
+		node = n.parent;
+	}
+}
+
+i32 AABBTree::balance(i32 iA) {
+	Node& A = m_nodes[iA];
+	if (A.leaf() || A.height < 2) return iA;
+
+	const i32 iB = A.child1, iC = A.child2;
+	Node& B = m_nodes[iB];
+	Node& C = m_nodes[iC];
+	const i32 diff = C.height - B.height;
+
+	// The taller child becomes the root of the subtree, A takes its shorter grandchild
+	auto rotateUp = [&](i32 iUp, Node& up, Node& other, bool upIsChild2) {
+		const i32 iF = up.child1, iG = up.child2;
+		Node& F = m_nodes[iF];
+		Node& G = m_nodes[iG];
+
+		up.child1 = iA;
+		up.parent = A.parent;
+		A.parent = iUp;
+
+		if (up.parent != NULL_NODE) {
+			Node& p = m_nodes[up.parent];
+			if (p.child1 == iA) p.child1 = iUp;
+			else p.child2 = iUp;
+		} else {
+			m_root = iUp;
+		}
+
+		const bool keepF = F.height > G.height;
+		const i32 iKeep = keepF ? iF : iG, iGive = keepF ? iG : iF;
+		Node& keep = m_nodes[iKeep];
+		Node& give = m_nodes[iGive];
+
+		up.child2 = iKeep;
+		if (upIsChild2) A.child2 = iGive;
+		else A.child1 = iGive;
+		give.parent = iA;
+
+		A.box = other.box.merged(give.box);
+		up.box = A.box.merged(keep.box);
+		A.height = 1 + std::max(other.height, give.height);
+		up.height = 1 + std::max(A.height, keep.height);
+		return iUp;
+	};
+
+	if (diff > 1) return rotateUp(iC, C, B, true);
+	if (diff < -1) return rotateUp(iB, B, C, false);
+	return iA;
+}
+
+NS_END
@@ -0,0 +1,197 @@
+#ifndef AABB_TREE_H
+#define AABB_TREE_H
+
+#include "aabb.h"
+#include "frustum.h"
+#include "../core/types.h"
+
+#include <algorithm>
+
+NS_BEGIN
+
+/// Dynamic bounding volume hierarchy. Each proxy (leaf) keeps its box grown by a margin, so
+/// small moves don't touch the tree, and inserts/removes keep it balanced with AVL style
+/// rotations. Queries over a small region visit O(log n) nodes.
+class AABBTree {
+public:
+	static constexpr i32 NULL_NODE = -1;
+
+	explicit AABBTree(float margin = 0.1f) : m_margin(margin) {}
+
+	/// Adds a box and returns its proxy id. 'data' is handed back by the queries.
+	i32 insert(const AABB& box, u64 data);
+	void remove(i32 proxy);
+
+	/// Updates the box of a proxy. Nothing happens while the fat box still fits it,
+	/// otherwise the proxy is reinserted and true is returned.
+	bool move(i32 proxy, const AABB& box);
+
+	void clear();
+
+	u64 data(i32 proxy) const { return m_nodes[proxy].data; }
+	const AABB& fatBox(i32 proxy) const { return m_nodes[proxy].box; }
+
+	u32 size() const { return m_leaves; }
+	u32 height() const { return m_root == NULL_NODE ? 0 : m_nodes[m_root].height; }
+
+	/// Calls func(proxy, data) for every proxy whose fat box overlaps 'box'. Returning false stops the query.
+	template <class F>
+	void query(const AABB& box, F&& func) const {
+		traverse([&](const AABB& b) { return b.overlaps(box); }, func);
+	}
+
+	/// Same, for the proxies touching a sphere.
+	template <class F>
+	void query(const Vec3& center, float radius, F&& func) const {
+		const float radiusSq = radius * radius;
+		traverse([&](const AABB& b) { return b.distanceSq(center) <= radiusSq; }, func);
+	}
+
+	/// Same, for the proxies inside or crossing a frustum. Subtrees fully inside it are reported without more plane tests.
+	template <class F>
+	void query(const Frustum& frustum, F&& func) const;
+
+	/// Calls func(proxy, data, maxDistance) for the proxies whose fat box the ray crosses before 'maxDistance',
+	/// in no particular order. 'dir' must be normalized. func returns the distance to clip the ray to:
+	/// the hit distance to keep looking for closer hits only, 'maxDistance' to go on, 0 to stop.
+	template <class F>
+	void raycast(const Vec3& origin, const Vec3& dir, float maxDistance, F&& func) const;
+
+	/// Fills 'out' with the (at most) k proxies closest to 'point', nearest first, measured to their fat boxes.
+	void nearest(const Vec3& point, u32 k, Vector<i32>& out) const;
+
+private:
+	struct Node {
+		AABB box;
+		u64 data;
+		i32 parent, child1, child2;
+		i32 next; // Free list
+		i32 height; // 0 for leaves, -1 for free nodes
+
+		bool leaf() const { return child1 == NULL_NODE; }
+	};
+
+	// Traversal stack, only spills to the heap for very deep trees
+	struct Stack {
+		i32 fixed[64];
+		Vector<i32> more;
+		u32 count{ 0 };
+
+		void push(i32 node) {
+			if (count < 64) fixed[count] = node;
+			else more.push_back(node);
+			count++;
+		}
+
+		i32 pop() {
+			count--;
+			if (count < 64) return fixed[count];
+			i32 node = more.back();
+			more.pop_back();
+			return node;
+		}
+
+		bool empty() const { return count == 0; }
+	};
+
+	Vector<Node> m_nodes;
+	i32 m_root{ NULL_NODE }, m_free{ NULL_NODE };
+	u32 m_leaves{ 0 };
+	float m_margin;
+
+	i32 allocateNode();
+	void freeNode(i32 node);
+
+	void insertLeaf(i32 leaf);
+	void removeLeaf(i32 leaf);
+
+	/// Rotates the subtree at 'node' if its children's heights differ by more than one, returns its new root.
+	i32 balance(i32 node);
+
+	/// Rebalances and refits every node from 'node' up to the root.
+	void fixUpwards(i32 node);
+
+	template <class Test, class F>
+	void traverse(Test&& test, F& func) const {
+		if (m_root == NULL_NODE) return;
+
+		Stack stack;
+		stack.push(m_root);
+		while (!stack.empty()) {
+			i32 id = stack.pop();
+			const Node& node = m_nodes[id];
+			if (!test(node.box)) continue;
+
+			if (node.leaf()) {
+				if (!func(id, node.data)) return;
+			} else {
+				stack.push(node.child1);
+				stack.push(node.child2);
+			}
+		}
+	}
+};
+
+template <class F>
+void AABBTree::query(const Frustum& frustum, F&& func) const {
+	if (m_root == NULL_NODE) return;
+
+	Stack stack, inside;
+	stack.push(m_root);
+	while (!stack.empty()) {
+		i32 id = stack.pop();
+		const Node& node = m_nodes[id];
+		const Vec3 center = node.box.center(), extent = node.box.extent();
+		if (!frustum.intersects(center, extent)) continue;
+
+		if (node.leaf()) {
+			if (!func(id, node.data)) return;
+		} else if (frustum.contains(center, extent)) {
+			inside.push(id);
+			while (!inside.empty()) {
+				i32 subId = inside.pop();
+				const Node& sub = m_nodes[subId];
+				if (sub.leaf()) {
+					if (!func(subId, sub.data)) return;
+				} else {
+					inside.push(sub.child1);
+					inside.push(sub.child2);
+				}
+			}
+		} else {
+			stack.push(node.child1);
+			stack.push(node.child2);
+		}
+	}
+}
+
+template <class F>
+void AABBTree::raycast(const Vec3& origin, const Vec3& dir, float maxDistance, F&& func) const {
+	if (m_root == NULL_NODE) return;
+
+	// A zero direction component turns into an infinite slab
+	const Vec3 inv = 1.0f / dir;
+
+	Stack stack;
+	stack.push(m_root);
+	while (!stack.empty()) {
+		i32 id = stack.pop();
+		const Node& node = m_nodes[id];
+
+		float enter;
+		if (!node.box.raycast(origin, inv, maxDistance, enter)) continue;
+
+		if (node.leaf()) {
+			float clip = func(id, node.data, maxDistance);
+			if (clip <= 0.0f) return;
+			maxDistance = std::min(maxDistance, clip);
+		} else {
+			stack.push(node.child1);
+			stack.push(node.child2);
+		}
+	}
+}
+
+NS_END
+
+#endif // AABB_TREE_H
@@ -1,4 +1,7 @@
 #include "frustum.h"
+#include "simd.h"
+
+#include "glm/gtc/matrix_access.hpp"
 
 NS_BEGIN
 
@@ -13,14 +16,15 @@ void Plane::normalize() {
 	d /= mag;
 }
 
-NS_END
 Frustum::Frustum(const Mat4& mat, bool normalizePlanes) {
-	planes[0] = Plane(mat[3]+mat[0]);       // left
-	planes[1] = Plane(mat[3]-mat[0]);       // right
-	planes[2] = Plane(mat[3]-mat[1]);       // top
-	planes[3] = Plane(mat[3]+mat[1]);       // bottom
-	planes[4] = Plane(mat[3]+mat[2]);       // near
-	planes[5] = Plane(mat[3]-mat[2]);       // far
+	// glm matrices are column major, the planes come from the rows
+	Vec4 row0 = glm::row(mat, 0), row1 = glm::row(mat, 1), row2 = glm::row(mat, 2), row3 = glm::row(mat, 3);
+	planes[0] = Plane(row3+row0);       // left
+	planes[1] = Plane(row3-row0);       // right
+	planes[2] = Plane(row3-row1);       // top
+	planes[3] = Plane(row3+row1);       // bottom
+	planes[4] = Plane(row3+row2);       // near
+	planes[5] = Plane(row3-row2);       // far
 
 	if (normalizePlanes) {
 		planes[0].normalize();
@@ -31,3 +35,100 @@ Frustum::Frustum(const Mat4& mat, bool normalizePlanes) {
 		planes[5].normalize();
 	}
 }
+
+bool Frustum::intersects(const Vec3& center, const Vec3& extent) const {
+	for (const Plane& plane : planes) {
+		float dist = glm::dot(plane.normal, center) + plane.d;
+		float radius = glm::dot(glm::abs(plane.normal), extent);
+		if (dist + radius < 0.0f) return false;
+	}
+	return true;
+}
+
+bool Frustum::contains(const Vec3& center, const Vec3& extent) const {
+	for (const Plane& plane : planes) {
+		float dist = glm::dot(plane.normal, center) + plane.d;
+		float radius = glm::dot(glm::abs(plane.normal), extent);
+		if (dist - radius < 0.0f) return false;
+	}
+	return true;
+}
+
+u32 Frustum::cull(const BoxList& boxes, Vector<u32>& visible) const {
+	const u32 count = boxes.size();
+	const size_t before = visible.size();
+	visible.reserve(before + count);
+
+	u32 i = 0;
+#if defined(SIMD_SSE)
+	// Four boxes against one plane at a time: outside when dot(n, c) + d + dot(|n|, e) < 0
+	__m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], pd[6];
+	for (u32 p = 0; p < 6; p++) {
+		nx[p] = _mm_set1_ps(planes[p].normal.x);
+		ny[p] = _mm_set1_ps(planes[p].normal.y);
+		nz[p] = _mm_set1_ps(planes[p].normal.z);
+		ax[p] = _mm_set1_ps(std::abs(planes[p].normal.x));
+		ay[p] = _mm_set1_ps(std::abs(planes[p].normal.y));
+		az[p] = _mm_set1_ps(std::abs(planes[p].normal.z));
+		pd[p] = _mm_set1_ps(planes[p].d);
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4) {
+		__m128 cx = _mm_loadu_ps(&boxes.m_cx[i]), cy = _mm_loadu_ps(&boxes.m_cy[i]), cz = _mm_loadu_ps(&boxes.m_cz[i]);
+		__m128 ex = _mm_loadu_ps(&boxes.m_ex[i]), ey = _mm_loadu_ps(&boxes.m_ey[i]), ez = _mm_loadu_ps(&boxes.m_ez[i]);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (u32 p = 0; p < 6; p++) {
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)),
+				_mm_add_ps(_mm_mul_ps(nz[p], cz), pd[p])
+			);
+			__m128 radius = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)),
+				_mm_mul_ps(az[p], ez)
+			);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, radius), zero));
+
+			// Most boxes of a big scene are off screen, stop once all four are out
+			if (_mm_movemask_ps(inside) == 0) break;
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (u32 lane = 0; mask != 0; lane++, mask >>= 1) {
+			if (mask & 1) visible.push_back(i + lane);
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		if (intersects(boxes.center(i), boxes.extent(i))) {
+			visible.push_back(i);
+		}
+	}
+	return visible.size() - before;
+}
+
+void BoxList::clear() {
+	for (Vector<float>* stream : { &m_cx, &m_cy, &m_cz, &m_ex, &m_ey, &m_ez }) {
+		stream->clear();
+	}
+}
+
+void BoxList::reserve(u32 count) {
+	for (Vector<float>* stream : { &m_cx, &m_cy, &m_cz, &m_ex, &m_ey, &m_ez }) {
+		stream->reserve(count);
+	}
+}
+
+void BoxList::push(const Vec3& center, const Vec3& extent) {
+	m_cx.push_back(center.x); m_cy.push_back(center.y); m_cz.push_back(center.z);
+	m_ex.push_back(extent.x); m_ey.push_back(extent.y); m_ez.push_back(extent.z);
+}
+
+void BoxList::push(const AABB& local, const Mat4& model) {
+	AABB world = local.transformed(model);
+	push(world.center(), world.extent());
+}
+
+NS_END
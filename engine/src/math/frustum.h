@@ -3,6 +3,7 @@
 
 #include "vec.h"
 #include "mat.h"
+#include "aabb.h"
 #include "../core/types.h"
 
 #include <cmath>
@@ -20,11 +21,42 @@ public:
 	float d; // Distance from origin;
 };
 
+/// World-space boxes kept as center/half-extent streams, the layout Frustum::cull() reads.
+class BoxList {
+public:
+	void clear();
+	void reserve(u32 count);
+
+	void push(const Vec3& center, const Vec3& extent);
+
+	/// Axis aligned box around 'local' once transformed by 'model'.
+	void push(const AABB& local, const Mat4& model);
+
+	u32 size() const { return m_cx.size(); }
+
+	Vec3 center(u32 i) const { return Vec3(m_cx[i], m_cy[i], m_cz[i]); }
+	Vec3 extent(u32 i) const { return Vec3(m_ex[i], m_ey[i], m_ez[i]); }
+
+private:
+	friend class Frustum;
+	Vector<float> m_cx, m_cy, m_cz;
+	Vector<float> m_ex, m_ey, m_ez;
+};
+
 class Frustum {
 public:
 	Frustum() = default;
 	Frustum(const Mat4& mat, bool normalizePlanes = true);
 
+	/// False only when the box is fully outside one of the planes (conservative near the corners).
+	bool intersects(const Vec3& center, const Vec3& extent) const;
+
+	/// True when the box is inside every plane.
+	bool contains(const Vec3& center, const Vec3& extent) const;
+
+	/// Appends the index of every box that intersects the frustum to 'visible', returns how many were added.
+	u32 cull(const BoxList& boxes, Vector<u32>& visible) const;
+
 	Plane planes[6];
 };
 
@@ -0,0 +1,16 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Instruction sets the math kernels may use, picked at compile time.
+// SSE2 is always there on x86-64, build with ENGINE_USE_AVX2 for the 8-wide paths
+// and define ENGINE_NO_SIMD to force the scalar fallbacks.
+#if !defined(ENGINE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#	define SIMD_SSE 1
+#	include <emmintrin.h>
+#	if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#		define SIMD_AVX2 1
+#		include <immintrin.h>
+#	endif
+#endif
+
+#endif // SIMD_H
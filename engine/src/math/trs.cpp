@@ -0,0 +1,168 @@
+#include "trs.h"
+
+NS_BEGIN
+
+void TRSBatch::clear() {
+	for (Vector<float>* stream : { &m_px, &m_py, &m_pz, &m_qx, &m_qy, &m_qz, &m_qw, &m_sx, &m_sy, &m_sz }) {
+		stream->clear();
+	}
+}
+
+void TRSBatch::reserve(u32 count) {
+	for (Vector<float>* stream : { &m_px, &m_py, &m_pz, &m_qx, &m_qy, &m_qz, &m_qw, &m_sx, &m_sy, &m_sz }) {
+		stream->reserve(count);
+	}
+}
+
+void TRSBatch::push(const Vec3& position, const Quat& rotation, const Vec3& scale) {
+	m_px.push_back(position.x); m_py.push_back(position.y); m_pz.push_back(position.z);
+	m_qx.push_back(rotation.x); m_qy.push_back(rotation.y); m_qz.push_back(rotation.z); m_qw.push_back(rotation.w);
+	m_sx.push_back(scale.x); m_sy.push_back(scale.y); m_sz.push_back(scale.z);
+}
+
+TRSStreams TRSBatch::streams() const {
+	return {
+		m_px.data(), m_py.data(), m_pz.data(),
+		m_qx.data(), m_qy.data(), m_qz.data(), m_qw.data(),
+		m_sx.data(), m_sy.data(), m_sz.data()
+	};
+}
+
+/*
+ * With x2 = 2x (and so on), the rotation part of the matrix is
+ *   | 1 - (y*y2 + z*z2)   x*y2 - w*z2         x*z2 + w*y2       |
+ *   | x*y2 + w*z2         1 - (x*x2 + z*z2)   y*z2 - w*x2       |
+ *   | x*z2 - w*y2         y*z2 + w*x2         1 - (x*x2 + y*y2) |
+ * and each column is then multiplied by its scale factor.
+ */
+void composeTRSScalar(const TRSStreams& in, Mat4* out, u32 count, u32 first) {
+	for (u32 i = first; i < count; i++) {
+		float x = in.qx[i], y = in.qy[i], z = in.qz[i], w = in.qw[i];
+		float x2 = x + x, y2 = y + y, z2 = z + z;
+		float xx = x * x2, yy = y * y2, zz = z * z2;
+		float xy = x * y2, xz = x * z2, yz = y * z2;
+		float wx = w * x2, wy = w * y2, wz = w * z2;
+
+		float sx = in.sx[i], sy = in.sy[i], sz = in.sz[i];
+
+		Mat4& m = out[i];
+		m[0][0] = (1.0f - (yy + zz)) * sx; m[0][1] = (xy + wz) * sx; m[0][2] = (xz - wy) * sx; m[0][3] = 0.0f;
+		m[1][0] = (xy - wz) * sy; m[1][1] = (1.0f - (xx + zz)) * sy; m[1][2] = (yz + wx) * sy; m[1][3] = 0.0f;
+		m[2][0] = (xz + wy) * sz; m[2][1] = (yz - wx) * sz; m[2][2] = (1.0f - (xx + yy)) * sz; m[2][3] = 0.0f;
+		m[3][0] = in.px[i]; m[3][1] = in.py[i]; m[3][2] = in.pz[i]; m[3][3] = 1.0f;
+	}
+}
+
+#if defined(SIMD_SSE)
+// Lane k of (c0, c1, c2, c3) becomes column 'col' of out[k]
+static inline void storeColumn(Mat4* out, u32 col, __m128 c0, __m128 c1, __m128 c2, __m128 c3) {
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	_mm_storeu_ps(&out[0][col][0], c0);
+	_mm_storeu_ps(&out[1][col][0], c1);
+	_mm_storeu_ps(&out[2][col][0], c2);
+	_mm_storeu_ps(&out[3][col][0], c3);
+}
+
+static u32 composeTRSSSE(const TRSStreams& in, Mat4* out, u32 first, u32 count) {
+	const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+
+	u32 i = first;
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_loadu_ps(in.qx + i), y = _mm_loadu_ps(in.qy + i);
+		__m128 z = _mm_loadu_ps(in.qz + i), w = _mm_loadu_ps(in.qw + i);
+		__m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+		__m128 sx = _mm_loadu_ps(in.sx + i), sy = _mm_loadu_ps(in.sy + i), sz = _mm_loadu_ps(in.sz + i);
+
+		storeColumn(out + i, 0,
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx),
+			_mm_mul_ps(_mm_add_ps(xy, wz), sx),
+			_mm_mul_ps(_mm_sub_ps(xz, wy), sx),
+			zero);
+		storeColumn(out + i, 1,
+			_mm_mul_ps(_mm_sub_ps(xy, wz), sy),
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy),
+			_mm_mul_ps(_mm_add_ps(yz, wx), sy),
+			zero);
+		storeColumn(out + i, 2,
+			_mm_mul_ps(_mm_add_ps(xz, wy), sz),
+			_mm_mul_ps(_mm_sub_ps(yz, wx), sz),
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz),
+			zero);
+		storeColumn(out + i, 3, _mm_loadu_ps(in.px + i), _mm_loadu_ps(in.py + i), _mm_loadu_ps(in.pz + i), one);
+	}
+	return i;
+}
+#endif
+
+#if defined(SIMD_AVX2)
+// Lanes 0-3 go to out[0..3], lanes 4-7 to out[4..7]
+static inline void storeColumn8(Mat4* out, u32 col, __m256 c0, __m256 c1, __m256 c2, __m256 c3) {
+	storeColumn(out, col,
+		_mm256_castps256_ps128(c0), _mm256_castps256_ps128(c1),
+		_mm256_castps256_ps128(c2), _mm256_castps256_ps128(c3));
+	storeColumn(out + 4, col,
+		_mm256_extractf128_ps(c0, 1), _mm256_extractf128_ps(c1, 1),
+		_mm256_extractf128_ps(c2, 1), _mm256_extractf128_ps(c3, 1));
+}
+
+static u32 composeTRSAVX2(const TRSStreams& in, Mat4* out, u32 count) {
+	const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = _mm256_loadu_ps(in.qx + i), y = _mm256_loadu_ps(in.qy + i);
+		__m256 z = _mm256_loadu_ps(in.qz + i), w = _mm256_loadu_ps(in.qw + i);
+		__m256 x2 = _mm256_add_ps(x, x), y2 = _mm256_add_ps(y, y), z2 = _mm256_add_ps(z, z);
+		__m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+		__m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+
+		// w * a +/- b folded into one instruction
+		__m256 xyPwz = _mm256_fmadd_ps(w, z2, xy), xyMwz = _mm256_fnmadd_ps(w, z2, xy);
+		__m256 xzPwy = _mm256_fmadd_ps(w, y2, xz), xzMwy = _mm256_fnmadd_ps(w, y2, xz);
+		__m256 yzPwx = _mm256_fmadd_ps(w, x2, yz), yzMwx = _mm256_fnmadd_ps(w, x2, yz);
+
+		__m256 sx = _mm256_loadu_ps(in.sx + i), sy = _mm256_loadu_ps(in.sy + i), sz = _mm256_loadu_ps(in.sz + i);
+
+		storeColumn8(out + i, 0,
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx),
+			_mm256_mul_ps(xyPwz, sx),
+			_mm256_mul_ps(xzMwy, sx),
+			zero);
+		storeColumn8(out + i, 1,
+			_mm256_mul_ps(xyMwz, sy),
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy),
+			_mm256_mul_ps(yzPwx, sy),
+			zero);
+		storeColumn8(out + i, 2,
+			_mm256_mul_ps(xzPwy, sz),
+			_mm256_mul_ps(yzMwx, sz),
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz),
+			zero);
+		storeColumn8(out + i, 3, _mm256_loadu_ps(in.px + i), _mm256_loadu_ps(in.py + i), _mm256_loadu_ps(in.pz + i), one);
+	}
+	return i;
+}
+#endif
+
+void composeTRS(const TRSStreams& in, Mat4* out, u32 count) {
+	u32 done = 0;
+#if defined(SIMD_AVX2)
+	done = composeTRSAVX2(in, out, count);
+#endif
+#if defined(SIMD_SSE)
+	done = composeTRSSSE(in, out, done, count);
+#endif
+	composeTRSScalar(in, out, count, done);
+}
+
+void multiplyBatch(const Mat4* a, const Mat4* b, Mat4* out, u32 count) {
+	for (u32 i = 0; i < count; i++) {
+		multiply(a[i], b[i], out[i]);
+	}
+}
+
+NS_END
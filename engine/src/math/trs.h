@@ -0,0 +1,69 @@
+#ifndef TRS_H
+#define TRS_H
+
+#include "vec.h"
+#include "quat.h"
+#include "mat.h"
+#include "simd.h"
+#include "../core/types.h"
+
+NS_BEGIN
+
+/// Read-only structure-of-arrays view over a run of transforms. Rotations must be unit quaternions.
+struct TRSStreams {
+	const float *px, *py, *pz;
+	const float *qx, *qy, *qz, *qw;
+	const float *sx, *sy, *sz;
+};
+
+/// Owns the streams, filled one transform at a time.
+class TRSBatch {
+public:
+	void clear();
+	void reserve(u32 count);
+	void push(const Vec3& position, const Quat& rotation, const Vec3& scale);
+
+	u32 size() const { return m_px.size(); }
+	TRSStreams streams() const;
+
+private:
+	Vector<float> m_px, m_py, m_pz;
+	Vector<float> m_qx, m_qy, m_qz, m_qw;
+	Vector<float> m_sx, m_sy, m_sz;
+};
+
+/// Composes translate * rotate * scale for 'count' transforms, 4 or 8 at a time when SIMD is available.
+/// Gives the same matrices as glm::translate(p) * glm::mat4_cast(q) * glm::scale(s).
+void composeTRS(const TRSStreams& in, Mat4* out, u32 count);
+
+/// Plain C++ version of composeTRS(), also used for the leftovers of the SIMD loops.
+void composeTRSScalar(const TRSStreams& in, Mat4* out, u32 count, u32 first = 0);
+
+/// out[i] = a[i] * b[i].
+void multiplyBatch(const Mat4* a, const Mat4* b, Mat4* out, u32 count);
+
+/// out = a * b, 'out' may alias either input.
+inline void multiply(const Mat4& a, const Mat4& b, Mat4& out) {
+#if defined(SIMD_SSE)
+	const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+	const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+	const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+	const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+
+	// Column j of the result mixes the columns of 'a' with the entries of column j of 'b'
+	for (u32 j = 0; j < 4; j++) {
+		const __m128 bj = _mm_loadu_ps(&b[j][0]);
+		__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(0, 0, 0, 0)));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(1, 1, 1, 1))));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(2, 2, 2, 2))));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(3, 3, 3, 3))));
+		_mm_storeu_ps(&out[j][0], r);
+	}
+#else
+	out = a * b;
+#endif
+}
+
+NS_END
+
+#endif // TRS_H
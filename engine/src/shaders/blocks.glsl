@@ -0,0 +1,21 @@
+R"(// Uniform blocks the renderer uploads once per frame. Bindings and
+// layouts must match RendererSystem::BlockBinding and the Std140Writer code that fills them.
+layout (std140) uniform FrameBlock {
+	mat4 mProjection;
+	mat4 mView;
+	vec3 uEye;
+	vec2 uNF;
+};
+
+#ifdef MATERIAL_BLOCK_SIZE
+layout (std140) uniform MaterialBlock {
+	Material uMaterials[MATERIAL_BLOCK_SIZE];
+};
+#endif
+
+#ifdef LIGHT_BLOCK_SIZE
+layout (std140) uniform LightBlock {
+	Light uLights[LIGHT_BLOCK_SIZE];
+};
+#endif
+)"
@@ -5,6 +5,7 @@ layout (location = 2) out vec3 oRME;
 
 #define FRAGMENT_SHADER_COMMON
 #include common
+#include blocks
 
 in DATA {
 	vec3 position;
@@ -21,9 +22,9 @@ TexSlot2D(NormalMap)
 TexSlot2D(RMEMap)
 TexSlot2D(HeightMap)
 
-uniform Material material;
-
-uniform vec3 uEye;
+// Index into the material table of the MaterialBlock
+uniform int uMaterialID;
+#define material uMaterials[uMaterialID]
 
 vec2 parallaxMapping(vec2 texCoords, vec3 viewDir) {
 	vec2 tuv = transformUV(TexSlotGet(HeightMap).opt, texCoords);
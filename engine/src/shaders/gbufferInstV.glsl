@@ -15,8 +15,7 @@ out DATA {
 	mat3 tbn;
 } VSOut;
 
-uniform mat4 mProjection;
-uniform mat4 mView;
+#include blocks
 
 void main() {
 	vec4 pos = vModel * vec4(vPosition, 1.0);
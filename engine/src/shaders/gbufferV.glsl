@@ -14,8 +14,7 @@ out DATA {
 	mat3 tbn;
 } VSOut;
 
-uniform mat4 mProjection;
-uniform mat4 mView;
+#include blocks
 uniform mat4 mModel;
 
 void main() {
@@ -2,14 +2,12 @@ R"(#version 330 core
 #define FRAGMENT_SHADER_COMMON
 #include common
 #include brdf
+#include blocks
 
 out vec4 fragColor;
 
 in vec2 oScreenPosition;
 
-uniform mat4 mProjection;
-uniform mat4 mView;
-
 uniform sampler2D tNormals;
 uniform sampler2D tAlbedo;
 uniform sampler2D tRME;
@@ -23,10 +21,9 @@ uniform bool uShadowEnabled = false;
 uniform mat4 uLightViewProj;
 uniform float uLightFrustumSize = 1.0;
 
-uniform Light uLight;
-
-uniform vec3 uEye;
-uniform vec2 uNF;
+// Index of the light being drawn into the LightBlock
+uniform int uLightIndex;
+#define uLight uLights[uLightIndex]
 
 uniform bool uIBL;
 uniform bool uEmit;
@@ -26,6 +26,10 @@ PhysicsSystem::PhysicsSystem() {
 				btIDebugDraw::DBG_DrawWireframe | btIDebugDraw::DBG_DrawAabb
 	);
 	m_world->setDebugDrawer(m_debugDraw);
+
+	reads<RigidBody>();
+	writes<Transform>();
+	watches<Transform, RigidBody, CollisionShape>();
 }
 
 PhysicsSystem::~PhysicsSystem() {
@@ -40,8 +44,12 @@ PhysicsSystem::~PhysicsSystem() {
 
 void PhysicsSystem::update(EntityWorld& world, float dt) {
 	m_world->stepSimulation(dt, 10);
-	world.each([=](Entity& ent, RigidBody& R, Transform& T) {
+
+	// Each body only writes its own Transform, so the sync can run on all cores.
+	// Sleeping bodies haven't moved, leaving their Transform (and its change version) alone.
+	world.parallelEach([=](Entity& ent, RigidBody& R, Transform& T) {
 		btRigidBody *body = R.rigidBody();
+		if (!body->isActive()) return;
 
 		btTransform trans; body->getMotionState()->getWorldTransform(trans);
 
@@ -55,13 +63,11 @@ void PhysicsSystem::update(EntityWorld& world, float dt) {
 
 		T.position = position;
 		T.rotation = rotation;
+		ent.markChanged<Transform>();
 	});
 }
 
 void PhysicsSystem::entityCreated(EntityWorld& world, Entity& ent) {
-	bool entOK = ent.has<Transform, RigidBody, CollisionShape>();
-	if (!entOK) return;
-
 	Transform* T = ent.get<Transform>();
 	RigidBody* R = ent.get<RigidBody>();
 	CollisionShape* S = ent.get<CollisionShape>();
@@ -88,9 +94,6 @@ void PhysicsSystem::entityCreated(EntityWorld& world, Entity& ent) {
 }
 
 void PhysicsSystem::entityDestroyed(EntityWorld& world, Entity& ent) {
-	bool entOK = ent.has<RigidBody, CollisionShape>();
-	if (!entOK) return;
-
 	CollisionShape* S = ent.get<CollisionShape>();
 	RigidBody* R = ent.get<RigidBody>();
 
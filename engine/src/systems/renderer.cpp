@@ -1,6 +1,9 @@
 #include "renderer.h"
 
+#include "../core/app.h"
+
 #include <vector>
+#include <algorithm>
 
 NS_BEGIN
 
@@ -27,6 +30,13 @@ RendererSystem::RendererSystem(u32 width, u32 height) {
 	m_pov = nullptr;
 	m_materialID = 0;
 
+	// update() only advances the renderer's own clock
+	declaresNoComponents();
+
+	MessageSystem::get().subscribe<WindowResizedMessage>(this, [this](const WindowResizedMessage& msg) {
+		resizeBuffers(msg.width, msg.height);
+	});
+
 	m_gbuffer = Builder<FrameBuffer>::build()
 			.setSize(width, height)
 			.addRenderBuffer(TextureFormat::Depthf, Attachment::DepthAttachment)
@@ -65,6 +75,21 @@ RendererSystem::RendererSystem(u32 width, u32 height) {
 #include "../shaders/brdf.glsl"
 			;
 
+	String blocks =
+#include "../shaders/blocks.glsl"
+			;
+
+	// The material table takes as many materials as the GPU lets a block hold (16KB at least, 512 materials)
+	GLint maxBlockBytes = 0;
+	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockBytes);
+	m_materialBlockSize = std::min<u32>(MAX_MATERIALS, u32(maxBlockBytes) / MaterialStride);
+
+	// Fragment shaders also get the material and light tables
+	String blocksFS = Util::strCat(
+			"#define MATERIAL_BLOCK_SIZE ", m_materialBlockSize, "\n",
+			"#define LIGHT_BLOCK_SIZE ", LIGHT_BLOCK_SIZE, "\n"
+	) + blocks;
+
 	String gVS =
 #include "../shaders/gbufferV.glsl"
 			;
@@ -72,7 +97,9 @@ RendererSystem::RendererSystem(u32 width, u32 height) {
 #include "../shaders/gbufferF.glsl"
 			;
 
+	gVS = Util::replace(gVS, "#include blocks", blocks);
 	gFS = Util::replace(gFS, "#include common", common);
+	gFS = Util::replace(gFS, "#include blocks", blocksFS);
 	gFS = Util::replace(gFS, "#include brdf", brdf);
 
 	m_gbufferShader = Builder<ShaderProgram>::build()
@@ -84,6 +111,8 @@ RendererSystem::RendererSystem(u32 width, u32 height) {
 #include "../shaders/gbufferInstV.glsl"
 			;
 
+	giVS = Util::replace(giVS, "#include blocks", blocks);
+
 	m_gbufferInstancedShader = Builder<ShaderProgram>::build()
 			.add(giVS, ShaderType::VertexShader)
 			.add(gFS, ShaderType::FragmentShader);
@@ -99,6 +128,7 @@ RendererSystem::RendererSystem(u32 width, u32 height) {
 	lVS = Util::replace(lVS, "#include common", common);
 	lFS = Util::replace(lFS, "#include common", common);
 	lFS = Util::replace(lFS, "#include brdf", brdf);
+	lFS = Util::replace(lFS, "#include blocks", blocksFS);
 
 	m_lightingShader = Builder<ShaderProgram>::build()
 			.add(lVS, ShaderType::VertexShader)
@@ -191,6 +221,42 @@ RendererSystem::RendererSystem(u32 width, u32 height) {
 			.add(sFS, ShaderType::FragmentShader);
 	m_shadowInstancedShader.link();
 
+	// Everything render()/renderInstanced() sets per draw is looked up once, here
+	m_gbufferUniforms.resolve(m_gbufferShader);
+	m_gbufferInstancedUniforms.resolve(m_gbufferInstancedShader);
+	m_shadowUniforms.resolve(m_shadowShader);
+	m_shadowInstancedUniforms.resolve(m_shadowInstancedShader);
+	m_lightIndex = m_lightingShader.get("uLightIndex");
+	m_shadowMap = m_lightingShader.get("tShadowMap");
+	m_shadowEnabled = m_lightingShader.get("uShadowEnabled");
+	m_lightViewProj = m_lightingShader.get("uLightViewProj");
+	m_pickingModel = m_pickingShader.get("mModel");
+	m_pickingEID = m_pickingShader.get("uEID");
+
+	for (ShaderProgram* program : { &m_gbufferShader, &m_gbufferInstancedShader, &m_pickingShader, &m_lightingShader }) {
+		program->bindBlock("FrameBlock", FrameBinding);
+		program->bindBlock("MaterialBlock", MaterialBinding);
+		program->bindBlock("LightBlock", LightBinding);
+	}
+
+	m_frameBlock = Builder<VertexBuffer>::build();
+	m_frameBlock.bind(BufferType::UniformBuffer)
+			.allocate(FrameBlockBytes, BufferUsage::Dynamic)
+			.bindBase(FrameBinding)
+			.unbind();
+
+	m_materialBlock = Builder<VertexBuffer>::build();
+	m_materialBlock.bind(BufferType::UniformBuffer)
+			.allocate(m_materialBlockSize * MaterialStride, BufferUsage::Dynamic)
+			.bindBase(MaterialBinding)
+			.unbind();
+
+	m_lightBlock = Builder<VertexBuffer>::build();
+	m_lightBlock.bind(BufferType::UniformBuffer)
+			.allocate(LIGHT_BLOCK_SIZE * LightStride, BufferUsage::Dynamic)
+			.bindBase(LightBinding)
+			.unbind();
+
 	m_plane = Builder<Mesh>::build();
 	m_plane.addVertex(Vertex(Vec3(0, 0, 0)))
 		.addVertex(Vertex(Vec3(1, 0, 0)))
@@ -235,6 +301,41 @@ void RendererSystem::update(EntityWorld& world, float dt) {
 	m_time += dt;
 }
 
+static bool slotActive(const TextureSlot& slot) {
+	return slot.enabled && slot.texture.id() != 0;
+}
+
+// Same value for Texturers that set up the same texture state
+static u64 textureSetHash(const Texturer& tex) {
+	u64 hash = 14695981039346656037ull;
+	auto mix = [&](u64 v) { hash = (hash ^ v) * 1099511628211ull; };
+	for (const TextureSlot& slot : tex.textures) {
+		if (!slotActive(slot)) {
+			mix(0);
+			continue;
+		}
+		mix(slot.type);
+		mix(slot.texture.id());
+		mix(slot.sampler.id());
+		for (u32 i = 0; i < 4; i++) mix(u64(slot.uvTransform[i] * 4096.0f));
+	}
+	return hash;
+}
+
+static bool sameTextures(const Texturer& a, const Texturer& b) {
+	for (u32 i = 0; i < TextureSlotCount; i++) {
+		const TextureSlot& sa = a.textures[i];
+		const TextureSlot& sb = b.textures[i];
+		if (slotActive(sa) != slotActive(sb)) return false;
+		if (!slotActive(sa)) continue;
+		if (sa.type != sb.type || sa.texture.id() != sb.texture.id() ||
+			sa.sampler.id() != sb.sampler.id() || sa.uvTransform != sb.uvTransform) {
+			return false;
+		}
+	}
+	return true;
+}
+
 void RendererSystem::render(EntityWorld& world, FrameBuffer* target, Entity* pov) {
 	Entity* _pov = pov == nullptr ? m_pov : pov;
 	if (_pov == nullptr) {
@@ -249,11 +350,14 @@ void RendererSystem::render(EntityWorld& world, FrameBuffer* target, Entity* pov
 
 	Mat4 projMat = _pov->get<Camera>()->getProjection(m_renderWidth, m_renderHeight);
 
+	// Both the camera and the meshes are drawn where they are between the last two updates
+	m_alpha = world.renderAlpha();
+
 	Transform *camT = _pov->get<Transform>();
 	Mat4 viewMat(1.0f);
-	Quat qRot = glm::conjugate(camT->worldRotation());
+	Quat qRot = glm::conjugate(camT->worldRotation(m_alpha));
 	Mat4 rot = glm::mat4_cast(qRot);
-	Mat4 loc = glm::translate(Mat4(1.0f), camT->worldPosition() * -1.0f);
+	Mat4 loc = glm::translate(Mat4(1.0f), camT->worldPosition(m_alpha) * -1.0f);
 	viewMat = rot * loc;
 
 	if (!m_IBLGenerated && m_envMap.id() != 0) {
@@ -263,20 +367,37 @@ void RendererSystem::render(EntityWorld& world, FrameBuffer* target, Entity* pov
 
 	// Get all meshes
 	Vector<RenderMesh> renderMeshes;
+	m_bounds.clear();
+	m_meshSlots.clear();
+	m_textureSets.clear();
 
-	world.each([&](Entity &ent, Transform &T, Drawable3D &D) {
+	world.view<Transform, Drawable3D>().each([&](Entity &ent, Transform &T, Drawable3D &D) {
 		RenderMesh rm;
 		rm.mesh = D.mesh;
 		rm.materialID = D.materialID;
-		rm.modelMatrix = T.getTransformation();
+		rm.modelMatrix = T.getTransformation(m_alpha);
 		if (ent.has<Texturer>()) {
 			rm.texturer = *ent.get<Texturer>();
 		}
+		rm.meshSlot = m_meshSlots.emplace(rm.mesh.id(), m_meshSlots.size()).first->second;
+		rm.textureSet = m_textureSets.emplace(textureSetHash(rm.texturer), m_textureSets.size()).first->second;
+		m_bounds.push(rm.mesh.aabb(), rm.modelMatrix);
 		renderMeshes.push_back(rm);
 	});
 
+	m_stats = RenderStats();
+	m_stats.objects = renderMeshes.size();
+
+	cull(Frustum(projMat * viewMat), renderMeshes, m_visible);
+	m_stats.visible = m_visible.size();
+	m_stats.culled = m_stats.objects - m_stats.visible;
+
+	// Everything the passes share goes up in two uploads
+	uploadFrameBlock(projMat, viewMat, camT->worldPosition(m_alpha), *_pov->get<Camera>());
+	uploadMaterialBlock();
+
 	pickingPass(world, projMat, viewMat, renderMeshes);
-	gbufferPass(projMat, viewMat, renderMeshes);
+	gbufferPass(projMat, viewMat, renderMeshes, m_visible);
 	lightingPass(world, projMat, viewMat, renderMeshes);
 
 	finalPass(projMat, viewMat, renderMeshes, target);
@@ -288,13 +409,6 @@ void RendererSystem::render(EntityWorld& world, FrameBuffer* target, Entity* pov
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
-void RendererSystem::messageReceived(EntityWorld& world, const Message& msg) {
-	if (msg.type == "app_window_resized") {
-		Vec2 size = *((Vec2*)msg.data);
-		resizeBuffers(i32(size.x), i32(size.y));
-	}
-}
-
 void RendererSystem::resizeBuffers(u32 width, u32 height) {
 	glViewport(0, 0, width, height);
 
@@ -462,13 +576,11 @@ void RendererSystem::pickingPass(EntityWorld& world, const Mat4& projection, con
 	clear(ClearBufferMask::ColorBuffer | ClearBufferMask::DepthBuffer, 1, 1, 1, 1);
 
 	m_pickingShader.bind();
-	m_pickingShader.get("mProjection").set(projection);
-	m_pickingShader.get("mView").set(view);
 
 	// Render everything that has a transform
 	m_cube.bind();
-	world.each([&](Entity &ent, Transform &T) {
-		Mat4 modelMat = T.getTransformation();
+	world.view<Transform>().each([&](Entity &ent, Transform &T) {
+		Mat4 modelMat = T.getTransformation(m_alpha);
 
 		// Scale the cube to the same size of the object
 		Vec3 scale = Vec3(1.0f);
@@ -483,8 +595,8 @@ void RendererSystem::pickingPass(EntityWorld& world, const Mat4& projection, con
 		modelMat = glm::translate(modelMat, center);
 		modelMat = glm::scale(modelMat, scale);
 
-		m_pickingShader.get("mModel").set(modelMat);
-		m_pickingShader.get("uEID").set(ent.id());
+		m_pickingModel.set(modelMat);
+		m_pickingEID.set(u64(ent.index()));
 		m_cube.drawIndexed(PrimitiveType::Triangles, 0);
 	});
 	m_pickingShader.unbind();
@@ -492,7 +604,7 @@ void RendererSystem::pickingPass(EntityWorld& world, const Mat4& projection, con
 	m_pickingBuffer.unbind();
 }
 
-void RendererSystem::gbufferPass(const Mat4& projection, const Mat4& view, const Vector<RenderMesh>& renderables) {
+void RendererSystem::gbufferPass(const Mat4& projection, const Mat4& view, const Vector<RenderMesh>& renderables, const Vector<u32>& visible) {
 	glDisable(GL_BLEND);
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
@@ -503,28 +615,16 @@ void RendererSystem::gbufferPass(const Mat4& projection, const Mat4& view, const
 	clear(ClearBufferMask::ColorBuffer | ClearBufferMask::DepthBuffer, 0, 0, 0, 1);
 
 	m_gbufferShader.bind();
-	m_gbufferShader.get("mProjection").set(projection);
-	m_gbufferShader.get("mView").set(view);
-
-	if (m_pov) {
-		m_gbufferShader.get("uEye").set(m_pov->get<Transform>()->worldPosition());
-	}
 
-	if (!renderables.empty()) {
-		render(m_gbufferShader, renderables);
+	if (!visible.empty()) {
+		render(m_gbufferUniforms, RenderPass::GBuffer, view, renderables, visible);
 	}
 
 	m_gbufferShader.unbind();
 
 	m_gbufferInstancedShader.bind();
-	m_gbufferInstancedShader.get("mProjection").set(projection);
-	m_gbufferInstancedShader.get("mView").set(view);
 
-	if (m_pov) {
-		m_gbufferInstancedShader.get("uEye").set(m_pov->get<Transform>()->worldPosition());
-	}
-
-	renderInstanced(m_gbufferInstancedShader, renderables);
+	renderInstanced(m_gbufferInstancedUniforms, renderables, visible);
 
 	m_gbufferInstancedShader.unbind();
 
@@ -540,8 +640,6 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 	clear(ClearBufferMask::ColorBuffer, 0, 0, 0, 1);
 
 	m_lightingShader.bind();
-	m_lightingShader.get("mProjection").set(projection);
-	m_lightingShader.get("mView").set(view);
 
 	m_gbuffer.getColorAttachment(0).bind(m_screenTextureSampler, 0); // Normals
 	m_gbuffer.getColorAttachment(1).bind(m_screenTextureSampler, 1); // Albedo
@@ -553,12 +651,6 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 	m_lightingShader.get("tRME").set(2);
 	m_lightingShader.get("tDepth").set(3);
 
-	if (m_pov) {
-		Camera *cam = m_pov->get<Camera>();
-		m_lightingShader.get("uEye").set(m_pov->get<Transform>()->worldPosition());
-		m_lightingShader.get("uNF").set(Vec2(cam->zNear, cam->zFar));
-	}
-
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_ONE, GL_ONE);
 
@@ -585,12 +677,56 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 	m_plane.drawIndexed(PrimitiveType::Triangles, 0);
 	m_lightingShader.get("uEmit").set(false);
 
-	RenderCondition shadowRenderCond = [&](RenderMesh& rm) {
+	RenderCondition shadowRenderCond = [&](const RenderMesh& rm) {
 		return getMaterial(rm.materialID).castsShadow;
 	};
 
+	// Only the casters inside the light's own frustum get drawn into its shadow map
+	auto cullShadowCasters = [&](const Mat4& lightVP) {
+		cull(Frustum(lightVP), renderables, m_shadowVisible, shadowRenderCond);
+		m_stats.shadowVisible += m_shadowVisible.size();
+		m_stats.shadowCulled += renderables.size() - m_shadowVisible.size();
+	};
+
+	// Every light goes into the LightBlock table first, in the order the loops below draw them
+	m_lightData.clear();
+	u32 lightCount = 0;
+	auto putLight = [&](const LightBase& L, Transform& T, float radius, float size, float lightCutoff, float spotCutoff) {
+		m_lightData.beginStruct()
+			.put(L.color).put(L.intensity)
+			.put(radius).put(size).put(0.0f) // nearPlane
+			.put(T.worldPosition(m_alpha)).put(T.forward(m_alpha))
+			.put(lightCutoff).put(spotCutoff)
+			.put(i32(L.getType()))
+			.endStruct();
+		lightCount++;
+	};
+	world.view<Transform, DirectionalLight>().each([&](Entity& ent, Transform& T, DirectionalLight& L) {
+		putLight(L, T, 0.0f, L.size, 0.0f, 0.0f);
+	});
+	world.view<Transform, PointLight>().each([&](Entity& ent, Transform& T, PointLight& L) {
+		putLight(L, T, L.radius, 0.0f, L.lightCutOff, 0.0f);
+	});
+	world.view<Transform, SpotLight>().each([&](Entity& ent, Transform& T, SpotLight& L) {
+		putLight(L, T, L.radius, L.size, L.lightCutOff, L.spotCutOff);
+	});
+
+	// Selects the next light of the table, uploading it LIGHT_BLOCK_SIZE lights at a time
+	u32 lightIndex = 0;
+	auto nextLight = [&]() {
+		const u32 slot = lightIndex % LIGHT_BLOCK_SIZE;
+		if (slot == 0) {
+			const u32 count = std::min<u32>(lightCount - lightIndex, LIGHT_BLOCK_SIZE);
+			m_lightBlock.bind()
+					.setData(count * LightStride, m_lightData.data() + lightIndex * LightStride, BufferUsage::Dynamic)
+					.unbind();
+		}
+		m_lightIndex.set(i32(slot));
+		lightIndex++;
+	};
+
 	// Directional Lights
-	world.each([&](Entity& ent, Transform& T, DirectionalLight& L) {
+	world.view<Transform, DirectionalLight>().each([&](Entity& ent, Transform& T, DirectionalLight& L) {
 		Mat4 lightVP(1.0f);
 		if (L.shadows) {
 			m_finalBuffer.unbind();
@@ -605,23 +741,24 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 
 			float s = L.shadowFrustumSize;
 			Mat4 projMatLight = glm::ortho(-s, s, -s, s, -s, s);
-			Mat4 viewMatLight = glm::inverse(T.getTransformation());
+			Mat4 viewMatLight = glm::inverse(T.getTransformation(m_alpha));
 
 			lightVP = projMatLight * viewMatLight;
+			cullShadowCasters(lightVP);
 
 			m_shadowShader.bind();
-			m_shadowShader.get("mProjection").set(projMatLight);
-			m_shadowShader.get("mView").set(viewMatLight);
+			m_shadowUniforms.projection.set(projMatLight);
+			m_shadowUniforms.view.set(viewMatLight);
 
-			render(m_shadowShader, renderables, false, shadowRenderCond);
+			render(m_shadowUniforms, RenderPass::Shadow, viewMatLight, renderables, m_shadowVisible, false);
 
 			m_shadowShader.unbind();
 
 			m_shadowInstancedShader.bind();
-			m_shadowInstancedShader.get("mProjection").set(projMatLight);
-			m_shadowInstancedShader.get("mView").set(viewMatLight);
+			m_shadowInstancedUniforms.projection.set(projMatLight);
+			m_shadowInstancedUniforms.view.set(viewMatLight);
 
-			renderInstanced(m_shadowInstancedShader, renderables, false, shadowRenderCond);
+			renderInstanced(m_shadowInstancedUniforms, renderables, m_shadowVisible, false);
 
 			m_shadowInstancedShader.unbind();
 
@@ -637,18 +774,13 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 			m_plane.bind();
 		}
 
-		m_lightingShader.get("uLight.type").set(L.getType());
-		m_lightingShader.get("uLight.color").set(L.color);
-		m_lightingShader.get("uLight.intensity").set(L.intensity);
-
-		m_lightingShader.get("uLight.direction").set(T.forward());
+		nextLight();
 
 		// Shadow
 		m_shadowBuffer.getDepthAttachment().bind(m_screenDepthSampler, 7);
-		m_lightingShader.get("tShadowMap").set(7);
-		m_lightingShader.get("uShadowEnabled").set(L.shadows ? 1 : 0);
-		m_lightingShader.get("uLightViewProj").set(lightVP);
-		m_lightingShader.get("uLight.size").set(L.size);
+		m_shadowMap.set(7);
+		m_shadowEnabled.set(L.shadows ? 1 : 0);
+		m_lightViewProj.set(lightVP);
 
 		m_plane.drawIndexed(PrimitiveType::Triangles, 0);
 
@@ -656,20 +788,13 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 	});
 
 	// Point Lights
-	world.each([&](Entity& ent, Transform& T, PointLight& L) {
-		m_lightingShader.get("uLight.type").set(L.getType());
-		m_lightingShader.get("uLight.color").set(L.color);
-		m_lightingShader.get("uLight.intensity").set(L.intensity);
-
-		m_lightingShader.get("uLight.position").set(T.worldPosition());
-		m_lightingShader.get("uLight.radius").set(L.radius);
-		m_lightingShader.get("uLight.lightCutoff").set(L.lightCutOff);
-
+	world.view<Transform, PointLight>().each([&](Entity& ent, Transform& T, PointLight& L) {
+		nextLight();
 		m_plane.drawIndexed(PrimitiveType::Triangles, 0);
 	});
 
 	// Spot Lights
-	world.each([&](Entity& ent, Transform& T, SpotLight& L) {
+	world.view<Transform, SpotLight>().each([&](Entity& ent, Transform& T, SpotLight& L) {
 		Mat4 lightVP(1.0f);
 		if (L.shadows) {
 			m_finalBuffer.unbind();
@@ -684,23 +809,24 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 
 			float fov = L.spotCutOff * 2.0f;
 			Mat4 projMatLight = glm::perspective(fov, 1.0f, 0.01f, L.radius * 4.0f);
-			Mat4 viewMatLight = glm::inverse(T.getTransformation());
+			Mat4 viewMatLight = glm::inverse(T.getTransformation(m_alpha));
 
 			lightVP = projMatLight * viewMatLight;
+			cullShadowCasters(lightVP);
 
 			m_shadowShader.bind();
-			m_shadowShader.get("mProjection").set(projMatLight);
-			m_shadowShader.get("mView").set(viewMatLight);
+			m_shadowUniforms.projection.set(projMatLight);
+			m_shadowUniforms.view.set(viewMatLight);
 
-			render(m_shadowShader, renderables, false, shadowRenderCond);
+			render(m_shadowUniforms, RenderPass::Shadow, viewMatLight, renderables, m_shadowVisible, false);
 
 			m_shadowShader.unbind();
 
 			m_shadowInstancedShader.bind();
-			m_shadowInstancedShader.get("mProjection").set(projMatLight);
-			m_shadowInstancedShader.get("mView").set(viewMatLight);
+			m_shadowInstancedUniforms.projection.set(projMatLight);
+			m_shadowInstancedUniforms.view.set(viewMatLight);
 
-			renderInstanced(m_shadowInstancedShader, renderables, false, shadowRenderCond);
+			renderInstanced(m_shadowInstancedUniforms, renderables, m_shadowVisible, false);
 
 			m_shadowInstancedShader.unbind();
 
@@ -716,22 +842,13 @@ void RendererSystem::lightingPass(EntityWorld& world, const Mat4& projection, co
 			m_plane.bind();
 		}
 
-		m_lightingShader.get("uLight.type").set(L.getType());
-		m_lightingShader.get("uLight.color").set(L.color);
-		m_lightingShader.get("uLight.intensity").set(L.intensity);
-
-		m_lightingShader.get("uLight.position").set(T.worldPosition());
-		m_lightingShader.get("uLight.direction").set(T.forward());
-		m_lightingShader.get("uLight.radius").set(L.radius);
-		m_lightingShader.get("uLight.lightCutoff").set(L.lightCutOff);
-		m_lightingShader.get("uLight.spotCutoff").set(L.spotCutOff);
+		nextLight();
 
 		// Shadow
 		m_shadowBuffer.getDepthAttachment().bind(m_screenDepthSampler, 7);
-		m_lightingShader.get("tShadowMap").set(7);
-		m_lightingShader.get("uShadowEnabled").set(L.shadows ? 1 : 0);
-		m_lightingShader.get("uLightViewProj").set(lightVP);
-		m_lightingShader.get("uLight.size").set(L.size);
+		m_shadowMap.set(7);
+		m_shadowEnabled.set(L.shadows ? 1 : 0);
+		m_lightViewProj.set(lightVP);
 
 		m_plane.drawIndexed(PrimitiveType::Triangles, 0);
 	});
@@ -954,102 +1071,87 @@ void RendererSystem::renderScreenQuad() {
 	m_plane.drawIndexed(PrimitiveType::Triangles, 0);
 }
 
-void RendererSystem::render(ShaderProgram& shader, const Vector<RenderMesh>& renderables,
+void RendererSystem::cull(const Frustum& frustum, const Vector<RenderMesh>& renderables, Vector<u32>& out,
+						  const RenderCondition& cond)
+{
+	out.clear();
+	frustum.cull(m_bounds, out);
+	if (cond) {
+		out.erase(std::remove_if(out.begin(), out.end(), [&](u32 i) { return !cond(renderables[i]); }), out.end());
+	}
+}
+
+void RendererSystem::render(const DrawUniforms& shader, RenderPass pass, const Mat4& view,
+							const Vector<RenderMesh>& renderables, const Vector<u32>& indices,
 							bool textures, const RenderCondition& cond)
 {
-	for (RenderMesh rm : renderables) {
-		Material& mat = getMaterial(rm.materialID);
-		if (mat.instanced) continue;
+	m_queue.clear();
+	m_queue.reserve(indices.size());
+	for (u32 index : indices) {
+		const RenderMesh& rm = renderables[index];
+		if (getMaterial(rm.materialID).instanced) continue;
 		if (cond && !cond(rm)) continue;
 
-		shader.get("mModel").set(rm.modelMatrix);
+		float depth = -(view * rm.modelMatrix[3]).z;
+		u64 key = RenderQueue::makeKey(pass, shader.program, rm.materialID, textures ? rm.textureSet : 0, rm.meshSlot, depth);
+		m_queue.push(key, index);
+	}
+	m_queue.sort();
+
+	// State left by the previous draw is only set again when this one needs something else
+	const RenderMesh* last = nullptr;
+	for (const RenderQueue::Item& item : m_queue.items()) {
+		const RenderMesh& rm = renderables[item.index];
 
-		if (shader.has("material.roughness")) {
-			shader.get("material.roughness").set(mat.roughness);
-			shader.get("material.metallic").set(mat.metallic);
-			shader.get("material.emission").set(mat.emission);
-			shader.get("material.baseColor").set(mat.baseColor);
-			shader.get("material.heightScale").set(mat.heightScale);
-			shader.get("material.discardEdges").set(mat.discardParallaxEdges);
+		shader.model.set(rm.modelMatrix);
+
+		if (shader.hasMaterial && (!last || last->materialID != rm.materialID)) {
+			applyMaterial(shader, rm.materialID);
+			m_stats.materialBinds++;
 		}
 
-		if (textures) {
-			int sloti = 0;
-			shader.get("tAlbedo0.opt.enabled").set(false);
-			shader.get("tAlbedo1.opt.enabled").set(false);
-			shader.get("tNormalMap.opt.enabled").set(false);
-			shader.get("tRMEMap.opt.enabled").set(false);
-			shader.get("tHeightMap.opt.enabled").set(false);
-
-			for (TextureSlot& slot : rm.texturer.textures) {
-				if (!slot.enabled || slot.texture.id() == 0) continue;
-
-				String tname = "";
-				switch (slot.type) {
-					case TextureSlotType::NormalMap:
-						tname = "tNormalMap";
-						break;
-					case TextureSlotType::RougnessMetallicEmission:
-						tname = "tRMEMap";
-						break;
-					case TextureSlotType::Albedo0:
-						tname = "tAlbedo0";
-						break;
-					case TextureSlotType::Albedo1:
-						tname = "tAlbedo1";
-						break;
-					case TextureSlotType::HeightMap:
-						tname = "tHeightMap";
-						break;
-					default:
-						break;
-				}
+		if (textures && (!last || !sameTextures(last->texturer, rm.texturer))) {
+			applyTextures(shader, rm.texturer);
+			m_stats.textureBinds++;
+		}
 
-				if (!tname.empty()) {
-					slot.texture.bind(slot.sampler, sloti);
-					shader.get(tname + String(".img")).set(sloti);
-					shader.get(tname + String(".opt.enabled")).set(true);
-					shader.get(tname + String(".opt.uv_transform")).set(slot.uvTransform);
-					sloti++;
-				}
-			}
+		if (!last || last->mesh.id() != rm.mesh.id()) {
+			rm.mesh.bind();
+			m_stats.meshBinds++;
 		}
 
-		rm.mesh.bind();
 		rm.mesh.drawIndexed(PrimitiveType::Triangles, 0, rm.mesh.indexCount());
-
+		m_stats.drawCalls++;
+		last = &rm;
 	}
 }
 
-void RendererSystem::renderInstanced(ShaderProgram& shader, const Vector<RenderMesh>& renderables,
+void RendererSystem::renderInstanced(const DrawUniforms& shader, const Vector<RenderMesh>& renderables, const Vector<u32>& indices,
 									 bool textures, const RenderCondition& cond)
 {
-	UMap<u32, Material> instancedMaterials;
 	Map<u32, InstancedMesh> instancedMeshes;
 
-	for (RenderMesh rm : renderables) {
-		Material& mat = getMaterial(rm.materialID);
+	for (u32 index : indices) {
+		const RenderMesh& rm = renderables[index];
+		if (!getMaterial(rm.materialID).instanced) continue;
 		if (cond && !cond(rm)) continue;
-		if (mat.instanced) {
-			instancedMaterials[rm.materialID] = mat;
-			instancedMeshes[rm.materialID].mesh = rm.mesh;
-			instancedMeshes[rm.materialID].models.push_back(rm.modelMatrix);
-			instancedMeshes[rm.materialID].texturer = rm.texturer;
-		} else { continue; }
+
+		InstancedMesh& mi = instancedMeshes[rm.materialID];
+		if (mi.models.empty()) {
+			mi.mesh = rm.mesh;
+			mi.texturer = rm.texturer;
+		}
+		mi.models.push_back(rm.modelMatrix);
 	}
 
 	if (instancedMeshes.empty()) return;
 
 	for (Map<u32, InstancedMesh>::value_type &e : instancedMeshes) {
-		Material mat = instancedMaterials[e.first];
-		InstancedMesh mi = e.second;
-		Vector<Mat4> modelMats;
-
-		for (Mat4 &m : mi.models) {
-			modelMats.push_back(m);
-		}
+		const InstancedMesh& mi = e.second;
+		const Vector<Mat4>& modelMats = mi.models;
 
 		mi.mesh.bind();
+		m_stats.meshBinds++;
 		m_instanceBuffer.bind();
 
 		m_instanceBuffer.addVertexAttrib(5, 4, DataType::Float, false, sizeof(Mat4), 0);
@@ -1064,66 +1166,97 @@ void RendererSystem::renderInstanced(ShaderProgram& shader, const Vector<RenderM
 
 		m_instanceBuffer.setData(modelMats.size(), modelMats.data(), BufferUsage::Stream);
 
-		if (shader.has("material.roughness")) {
-			shader.get("material.roughness").set(mat.roughness);
-			shader.get("material.metallic").set(mat.metallic);
-			shader.get("material.emission").set(mat.emission);
-			shader.get("material.baseColor").set(mat.baseColor);
-			shader.get("material.heightScale").set(mat.heightScale);
-			shader.get("material.discardEdges").set(mat.discardParallaxEdges);
+		if (shader.hasMaterial) {
+			applyMaterial(shader, e.first);
+			m_stats.materialBinds++;
 		}
 
 		if (textures) {
-			int sloti = 0;
-			shader.get("tAlbedo0.opt.enabled").set(false);
-			shader.get("tAlbedo1.opt.enabled").set(false);
-			shader.get("tNormalMap.opt.enabled").set(false);
-			shader.get("tRMEMap.opt.enabled").set(false);
-			shader.get("tHeightMap.opt.enabled").set(false);
-
-			for (TextureSlot& slot : mi.texturer.textures) {
-				if (!slot.enabled || slot.texture.id() == 0) continue;
-
-				String tname = "";
-				switch (slot.type) {
-					case TextureSlotType::NormalMap:
-						tname = "tNormalMap";
-						break;
-					case TextureSlotType::RougnessMetallicEmission:
-						tname = "tRMEMap";
-						break;
-					case TextureSlotType::Albedo0:
-						tname = "tAlbedo0";
-						break;
-					case TextureSlotType::Albedo1:
-						tname = "tAlbedo1";
-						break;
-					case TextureSlotType::HeightMap:
-						tname = "tHeightMap";
-						break;
-					default:
-						break;
-				}
-
-				if (!tname.empty()) {
-					slot.texture.bind(slot.sampler, sloti);
-					shader.get(tname + String(".img")).set(sloti);
-					shader.get(tname + String(".opt.enabled")).set(true);
-					shader.get(tname + String(".opt.uv_transform")).set(slot.uvTransform);
-					sloti++;
-				}
-			}
+			applyTextures(shader, mi.texturer);
+			m_stats.textureBinds++;
 		}
 
 		mi.mesh.drawIndexedInstanced(
 				PrimitiveType::Triangles,
 				modelMats.size()
 		);
+		m_stats.drawCalls++;
 
 		mi.mesh.unbind();
 	}
 }
 
+void RendererSystem::uploadFrameBlock(const Mat4& projection, const Mat4& view, const Vec3& eye, const Camera& camera) {
+	m_blockData.clear();
+	m_blockData.put(projection).put(view).put(eye).put(Vec2(camera.zNear, camera.zFar));
+
+	m_frameBlock.bind()
+			.setData(m_blockData.size(), m_blockData.data(), BufferUsage::Dynamic)
+			.unbind();
+}
+
+void RendererSystem::uploadMaterialBlock() {
+	if (m_materialID == 0) return;
+
+	m_blockData.clear();
+	for (u32 i = 0; i < m_materialID; i++) {
+		const Material& mat = m_materials[i].mat;
+		m_blockData.beginStruct()
+			.put(mat.baseColor)
+			.put(mat.roughness).put(mat.metallic).put(mat.emission)
+			.put(mat.heightScale).put(mat.discardParallaxEdges)
+			.endStruct();
+	}
+
+	m_materialBlock.bind()
+			.setData(m_blockData.size(), m_blockData.data(), BufferUsage::Dynamic)
+			.unbind();
+}
+
+void RendererSystem::applyMaterial(const DrawUniforms& shader, u32 materialID) {
+	shader.materialID.set(i32(std::min(materialID, m_materialBlockSize - 1)));
+}
+
+void RendererSystem::applyTextures(const DrawUniforms& shader, const Texturer& texturer) {
+	for (const DrawUniforms::TextureUniforms& tu : shader.textures) {
+		tu.enabled.set(false);
+	}
+
+	int sloti = 0;
+	for (const TextureSlot& slot : texturer.textures) {
+		if (!slot.enabled || slot.texture.id() == 0 || slot.type >= TextureSlotCount) continue;
+
+		const DrawUniforms::TextureUniforms& tu = shader.textures[slot.type];
+		slot.texture.bind(slot.sampler, sloti);
+		tu.img.set(sloti);
+		tu.enabled.set(true);
+		tu.uvTransform.set(slot.uvTransform);
+		sloti++;
+	}
+}
+
+void DrawUniforms::resolve(ShaderProgram& shader) {
+	// Same order as TextureSlotType
+	static const char* textureNames[TextureSlotCount] = {
+		"tAlbedo0", "tAlbedo1", "tNormalMap", "tRMEMap", "tHeightMap"
+	};
+
+	program = shader.id();
+	model = shader.get("mModel");
+	projection = shader.get("mProjection");
+	view = shader.get("mView");
+
+	hasMaterial = shader.has("uMaterialID");
+	materialID = shader.get("uMaterialID");
+
+	for (u32 i = 0; i < TextureSlotCount; i++) {
+		String name = textureNames[i];
+		textures[i].img = shader.get(name + ".img");
+		textures[i].enabled = shader.get(name + ".opt.enabled");
+		textures[i].uvTransform = shader.get(name + ".opt.uv_transform");
+	}
+}
+
 u32 RendererSystem::renderWidth() const {
 	return m_renderWidth;
 }
@@ -1137,7 +1270,12 @@ void RendererSystem::setPOV(Entity* pov) {
 }
 
 Material& RendererSystem::createMaterial(const String& name) {
-	assert(m_materialID < MAX_MATERIALS && "Too many materials!");
+	// The material table can be smaller than MAX_MATERIALS, depending on the GPU. Past it, the
+	// last material is handed back so shaders never index outside uMaterials.
+	if (m_materialID >= m_materialBlockSize) {
+		LogError("Too many materials, this GPU holds ", m_materialBlockSize, ".");
+		return m_materials[m_materialBlockSize - 1].mat;
+	}
 
 	String _name = name;
 	if (_name.empty()) {
@@ -10,10 +10,14 @@
 #include "../gfx/material.h"
 #include "../components/light.h"
 #include "../components/texturer.h"
+#include "../math/frustum.h"
+#include "../gfx/render_queue.h"
+#include "../gfx/std140.h"
 
 NS_BEGIN
 
 #define MAX_MATERIALS 2048
+#define LIGHT_BLOCK_SIZE 128
 
 struct Drawable3D : public Component {
 	Drawable3D() = default;
@@ -41,6 +45,28 @@ struct RenderMesh {
 	u32 materialID;
 	Mat4 modelMatrix;
 	Texturer texturer;
+
+	// Small per-frame ids of the mesh and of the texture set, for the render queue keys
+	u32 meshSlot{ 0 }, textureSet{ 0 };
+};
+
+/// Uniforms render()/renderInstanced() set for every draw, looked up once after linking so
+/// drawing does no string work. Uniforms the shader doesn't have stay invalid, setting them does nothing.
+struct DrawUniforms {
+	struct TextureUniforms {
+		Uniform img, enabled, uvTransform;
+	};
+
+	void resolve(ShaderProgram& shader);
+
+	GLuint program{ 0 };
+	Uniform model;
+	Uniform projection, view; ///< Set once per pass by the shadow shaders, the others read the FrameBlock
+
+	bool hasMaterial{ false };
+	Uniform materialID; ///< Index into the MaterialBlock, the material itself is uploaded once per frame
+
+	Array<TextureUniforms, TextureSlotCount> textures; ///< Indexed by TextureSlotType
 };
 
 struct MaterialSlot {
@@ -60,7 +86,18 @@ struct Camera : public Component {
 	Mat4 getProjection(u32 width, u32 height);
 };
 
-using RenderCondition = Fn<bool(RenderMesh&)>;
+using RenderCondition = Fn<bool(const RenderMesh&)>;
+
+/// Counters of the last render(), shadow ones are summed over every shadow casting light.
+struct RenderStats {
+	u32 objects{ 0 };
+	u32 visible{ 0 }, culled{ 0 };
+	u32 shadowVisible{ 0 }, shadowCulled{ 0 };
+
+	// Draws and the state changes the render queue couldn't avoid, over every pass
+	u32 drawCalls{ 0 };
+	u32 meshBinds{ 0 }, materialBinds{ 0 }, textureBinds{ 0 };
+};
 
 class RendererSystem : public EntitySystem {
 public:
@@ -69,7 +106,6 @@ public:
 
 	void update(EntityWorld& world, float dt);
 	void render(EntityWorld& world, FrameBuffer* target, Entity* POV);
-	void messageReceived(EntityWorld& world, const Message& msg);
 
 	void resizeBuffers(u32 width, u32 height);
 
@@ -104,6 +140,8 @@ public:
 
 	Vector<Filter>& postEffects() { return m_postEffects; }
 
+	const RenderStats& stats() const { return m_stats; }
+
 private:
 	// Camera
 	Entity* m_pov;
@@ -126,6 +164,9 @@ private:
 					m_shadowShader,
 					m_shadowInstancedShader;
 
+	DrawUniforms m_gbufferUniforms, m_gbufferInstancedUniforms,
+				m_shadowUniforms, m_shadowInstancedUniforms;
+
 	// EnvMap
 	Texture m_envMap, m_irradiance, m_radiance, m_brdf;
 
@@ -137,25 +178,69 @@ private:
 
 	VertexBuffer m_instanceBuffer;
 
+	// Uniform blocks of shaders/blocks.glsl, uploaded once per render() instead of per draw/light
+	enum BlockBinding : u32 {
+		FrameBinding = 0,
+		MaterialBinding,
+		LightBinding
+	};
+
+	// std140 sizes of the FrameBlock and of one Material/Light element
+	static constexpr u32 FrameBlockBytes = 160, MaterialStride = 32, LightStride = 80;
+
+	VertexBuffer m_frameBlock, m_materialBlock, m_lightBlock;
+	Std140Writer m_blockData, m_lightData;
+	u32 m_materialBlockSize{ 0 };
+	Uniform m_lightIndex;
+
+	// Set per picked entity and per light, looked up once after linking like DrawUniforms
+	Uniform m_pickingModel, m_pickingEID;
+	Uniform m_shadowMap, m_shadowEnabled, m_lightViewProj;
+
 	// PostFX
 	Vector<Filter> m_postEffects;
 	float m_time;
 
+	// Interpolation alpha of the frame being rendered
+	float m_alpha{ 1.0f };
+
+	// Culling, m_bounds holds the world box of each renderable (same order)
+	BoxList m_bounds;
+	Vector<u32> m_visible, m_shadowVisible;
+	RenderStats m_stats;
+
+	RenderQueue m_queue;
+	UMap<GLuint, u32> m_meshSlots;
+	UMap<u64, u32> m_textureSets;
+
 	void computeIrradiance();
 	void computeRadiance();
 	void computeBRDF();
 	void computeIBL();
 
 	void pickingPass(EntityWorld& world, const Mat4& projection, const Mat4& view, const Vector<RenderMesh>& renderables);
-	void gbufferPass(const Mat4& projection, const Mat4& view, const Vector<RenderMesh>& renderables);
+	void gbufferPass(const Mat4& projection, const Mat4& view, const Vector<RenderMesh>& renderables, const Vector<u32>& visible);
 	void lightingPass(EntityWorld& world, const Mat4& projection, const Mat4& view, const Vector<RenderMesh>& renderables);
 	void finalPass(const Mat4& projection, const Mat4& view, const Vector<RenderMesh>& renderables, FrameBuffer* target);
 
-	void render(ShaderProgram& shader, const Vector<RenderMesh>& renderables,
+	/// Fills 'out' with the indices of the renderables inside 'frustum' that pass 'cond'.
+	void cull(const Frustum& frustum, const Vector<RenderMesh>& renderables, Vector<u32>& out,
+			  const RenderCondition& cond = nullptr);
+
+	/// Draws renderables[i] for every i of 'indices', sorted through the render queue so that draws
+	/// sharing a material, textures or mesh only set them up once. 'view' orders them front to back.
+	void render(const DrawUniforms& shader, RenderPass pass, const Mat4& view,
+				const Vector<RenderMesh>& renderables, const Vector<u32>& indices,
 				bool textures = true, const RenderCondition& cond = nullptr);
-	void renderInstanced(ShaderProgram& shader, const Vector<RenderMesh>& renderables,
+	void renderInstanced(const DrawUniforms& shader, const Vector<RenderMesh>& renderables, const Vector<u32>& indices,
 						bool textures = true, const RenderCondition& cond = nullptr);
 
+	void uploadFrameBlock(const Mat4& projection, const Mat4& view, const Vec3& eye, const Camera& camera);
+	void uploadMaterialBlock();
+
+	void applyMaterial(const DrawUniforms& shader, u32 materialID);
+	void applyTextures(const DrawUniforms& shader, const Texturer& texturer);
+
 	u32 m_renderWidth, m_renderHeight;
 
 	Array<MaterialSlot, MAX_MATERIALS> m_materials;
@@ -0,0 +1,97 @@
+#include "spatial_system.h"
+
+#include "renderer.h"
+#include "../components/transform.h"
+#include "../components/light.h"
+
+NS_BEGIN
+
+SpatialSystem::SpatialSystem(float margin)
+	: m_drawables(margin), m_lights(margin)
+{
+	reads<Transform, Drawable3D, PointLight, SpotLight>();
+}
+
+void SpatialSystem::update(EntityWorld& world, float dt) {
+	refresh(world);
+}
+
+void SpatialSystem::refresh(EntityWorld& world) {
+	m_frame++;
+	const u32 since = m_since;
+	m_since = world.changeTick();
+
+	// TransformSystem flags the Transforms it gives a new world matrix, the rest keep their box
+	world.view<Transform, Drawable3D>().each([&](Entity& ent, Transform& T, Drawable3D& D) {
+		// A mesh without vertices still gets a point-sized box at the entity
+		const AABB local = D.mesh.aabb().empty() ? AABB(Vec3(0.0f), Vec3(0.0f)) : D.mesh.aabb();
+
+		auto found = m_drawableProxies.find(ent.id());
+		if (found == m_drawableProxies.end()) {
+			AABB box = local.transformed(T.getTransformation());
+			i32 id = m_drawables.insert(box, ent.id());
+			if (u32(id) >= m_boxes.size()) m_boxes.resize(id + 1);
+			m_boxes[id] = box;
+			m_drawableProxies[ent.id()] = { id, m_frame, local };
+			return;
+		}
+
+		Proxy& proxy = found->second;
+		proxy.seen = m_frame;
+
+		bool meshChanged = local.min() != proxy.local.min() || local.max() != proxy.local.max();
+		if (!meshChanged && !ent.changedSince<Transform>(since)) return;
+
+		AABB box = local.transformed(T.getTransformation());
+		m_drawables.move(proxy.id, box);
+		m_boxes[proxy.id] = box;
+		proxy.local = local;
+	});
+	sweep(m_drawables, m_drawableProxies);
+
+	// Lights are few and their radius is edited in place, so they're always refitted
+	auto syncLight = [&](Entity& ent, Transform& T, float radius) {
+		Vec3 center = T.worldPosition();
+		AABB box(center - Vec3(radius), center + Vec3(radius));
+
+		auto found = m_lightProxies.find(ent.id());
+		if (found == m_lightProxies.end()) {
+			m_lightProxies[ent.id()] = { m_lights.insert(box, ent.id()), m_frame, AABB() };
+		} else {
+			found->second.seen = m_frame;
+			m_lights.move(found->second.id, box);
+		}
+	};
+	world.view<Transform, PointLight>().each([&](Entity& ent, Transform& T, PointLight& L) {
+		syncLight(ent, T, L.radius);
+	});
+	world.view<Transform, SpotLight>().each([&](Entity& ent, Transform& T, SpotLight& L) {
+		syncLight(ent, T, L.radius);
+	});
+	sweep(m_lights, m_lightProxies);
+}
+
+u64 SpatialSystem::raycast(const Vec3& origin, const Vec3& dir, float maxDistance) const {
+	const Vec3 inv = 1.0f / dir;
+	u64 hit = ECS_INVALID_ENTITY;
+	m_drawables.raycast(origin, dir, maxDistance, [&](i32 proxy, u64 entity, float maxDist) {
+		float distance;
+		if (!m_boxes[proxy].raycast(origin, inv, maxDist, distance)) return maxDist;
+		hit = entity;
+		return distance;
+	});
+	return hit;
+}
+
+void SpatialSystem::sweep(AABBTree& tree, UMap<u64, Proxy>& proxies) {
+	for (auto it = proxies.begin(); it != proxies.end();) {
+		if (it->second.seen != m_frame) {
+			tree.remove(it->second.id);
+			it = proxies.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+NS_END
@@ -0,0 +1,49 @@
+#ifndef SPATIAL_SYSTEM_H
+#define SPATIAL_SYSTEM_H
+
+#include "../core/types.h"
+#include "../core/ecs.h"
+#include "../math/aabb_tree.h"
+
+NS_BEGIN
+
+/// Keeps two AABBTrees up to date: world boxes of the Drawable3Ds and the spheres of reach of
+/// the point/spot lights. The tree data is the entity id. Register it after TransformSystem,
+/// it only recomputes the boxes of the entities whose Transform changed since its last refresh.
+class SpatialSystem : public EntitySystem {
+public:
+	explicit SpatialSystem(float margin = 0.1f);
+
+	void update(EntityWorld& world, float dt) override;
+
+	/// Syncs the trees with the world. update() calls it, editors that don't update the world can call it directly.
+	void refresh(EntityWorld& world);
+
+	const AABBTree& drawables() const { return m_drawables; }
+	const AABBTree& lights() const { return m_lights; }
+
+	/// Entity of the nearest drawable whose world box the ray hits, ECS_INVALID_ENTITY if none.
+	u64 raycast(const Vec3& origin, const Vec3& dir, float maxDistance = 1000.0f) const;
+
+private:
+	struct Proxy {
+		i32 id;
+		u32 seen;
+		AABB local; // Mesh bounds the proxy was built from, to catch mesh swaps
+	};
+
+	AABBTree m_drawables, m_lights;
+	UMap<u64, Proxy> m_drawableProxies, m_lightProxies;
+
+	// Tight world box of each drawable, indexed by proxy id (the tree only keeps fat ones)
+	Vector<AABB> m_boxes;
+
+	u32 m_frame{ 0 }, m_since{ 0 };
+
+	/// Drops the proxies of entities that weren't seen this refresh.
+	void sweep(AABBTree& tree, UMap<u64, Proxy>& proxies);
+};
+
+NS_END
+
+#endif // SPATIAL_SYSTEM_H
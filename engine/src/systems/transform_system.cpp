@@ -0,0 +1,230 @@
+#include "transform_system.h"
+
+#include <limits>
+
+NS_BEGIN
+
+TransformSystem::TransformSystem() {
+	writes<Transform>();
+}
+
+void TransformSystem::update(EntityWorld& world, float dt) {
+	refresh(world);
+}
+
+void TransformSystem::refresh(EntityWorld& world) {
+	const u32 since = m_since;
+	m_since = world.changeTick();
+
+	// Pick up new Transforms, parent changes and moved nodes among the flagged ones (assign()
+	// flags too). Whatever moved is queued for the batched TRS kernel, nothing is computed here.
+	// The write-back below flags what it touches, those come back once and compare equal.
+	m_batch.clear();
+	m_batchNodes.clear();
+	View<Transform>& transforms = world.view<Transform>();
+	transforms.eachChanged<Transform>(since, [&](Entity& ent, Transform& T) {
+		u32 node = T.m_node;
+		if (node >= m_nodes.size() || m_nodes[node].entity != ent.id()) {
+			node = addNode(ent.id());
+			T.m_node = node;
+			T.m_snap = true;
+		}
+
+		Node& n = m_nodes[node];
+		if (n.parent != T.m_parent) {
+			n.parent = T.m_parent;
+			m_rebuild = true;
+			markDirty(node);
+		}
+
+		Local& local = m_locals[node];
+		if (local.position != T.position || local.rotation != T.rotation || local.scale != T.scale) {
+			local.position = T.position;
+			local.rotation = T.rotation;
+			local.scale = T.scale;
+			m_batch.push(T.position, T.rotation, T.scale);
+			m_batchNodes.push_back(node);
+			markDirty(node);
+		}
+	});
+
+	if (!m_batchNodes.empty()) {
+		m_composed.resize(m_batchNodes.size());
+		composeTRS(m_batch.streams(), m_composed.data(), m_batchNodes.size());
+		for (u32 i = 0; i < m_batchNodes.size(); i++) {
+			m_local[m_batchNodes[i]] = m_composed[i];
+		}
+	}
+
+	// New nodes already asked for a rebuild, so a count mismatch means some Transforms are gone
+	// (destroyed entity or removed component)
+	if (transforms.size() != m_nodes.size()) {
+		m_rebuild = true;
+	}
+	if (m_rebuild) {
+		rebuild(world);
+	}
+
+	// What moved in the last refresh stops blending unless it moves again below
+	for (u64 id : m_written) {
+		Entity* ent = world.getEntity(id);
+		Transform* T = ent ? ent->get<Transform>() : nullptr;
+		if (T && T->m_moving) {
+			T->m_prevPose = T->m_pose;
+			T->m_moving = false;
+		}
+	}
+	m_written.clear();
+	if (m_firstDirty >= m_nodes.size()) return;
+
+	// Parents come first, so their world matrix is final by the time their children need it
+	for (u32 i = m_firstDirty; i < m_nodes.size(); i++) {
+		i32 parent = m_nodes[i].parentIndex;
+		if (parent >= 0) {
+			m_dirty[i] |= m_dirty[parent];
+			if (m_dirty[i]) multiply(m_world[parent], m_local[i], m_world[i]);
+		} else if (m_dirty[i]) {
+			m_world[i] = m_local[i];
+		}
+	}
+
+	// The pose being replaced becomes the previous one, for render interpolation. Transforms
+	// with a new world matrix are flagged as changed for the systems that follow.
+	for (u32 i = m_firstDirty; i < m_nodes.size(); i++) {
+		if (!m_dirty[i]) continue;
+		m_dirty[i] = 0;
+
+		Entity* ent = world.getEntity(m_nodes[i].entity);
+		ent->get<Transform>()->setWorld(m_world[i]);
+		ent->markChanged<Transform>();
+		m_written.push_back(m_nodes[i].entity);
+	}
+	m_firstDirty = ~0u;
+}
+
+u32 TransformSystem::addNode(u64 entity) {
+	// NaN never compares equal, so the first refresh always builds the local matrix
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+
+	m_nodes.push_back({ entity, ECS_INVALID_ENTITY, -1 });
+	m_locals.push_back({ Vec3(nan), Vec3(nan), Quat(nan, nan, nan, nan) });
+	m_local.push_back(Mat4(1.0f));
+	m_world.push_back(Mat4(1.0f));
+	m_dirty.push_back(0);
+	markDirty(m_nodes.size() - 1);
+	m_rebuild = true;
+	return m_nodes.size() - 1;
+}
+
+void TransformSystem::markDirty(u32 node) {
+	m_dirty[node] = 1;
+	m_firstDirty = std::min(m_firstDirty, node);
+}
+
+void TransformSystem::rebuild(EntityWorld& world) {
+	const u32 count = m_nodes.size();
+
+	// A node is live while its entity has a Transform that still points at it
+	Vector<Transform*> owners(count, nullptr);
+	UMap<u64, u32> byEntity;
+	byEntity.reserve(count);
+	for (u32 i = 0; i < count; i++) {
+		Entity* ent = world.getEntity(m_nodes[i].entity);
+		Transform* T = ent ? ent->get<Transform>() : nullptr;
+		if (T && T->m_node == i) {
+			owners[i] = T;
+			byEntity[m_nodes[i].entity] = i;
+		}
+	}
+
+	// Missing parents (dead, or without a Transform) make their children roots
+	Vector<i32> parentOf(count, -1);
+	for (u32 i = 0; i < count; i++) {
+		auto found = byEntity.find(m_nodes[i].parent);
+		if (owners[i] && found != byEntity.end()) {
+			parentOf[i] = found->second;
+		}
+	}
+
+	// Depth of every live node, walking up until a known depth. A node met twice on the
+	// same walk is a cycle, which is cut by turning the last node of the walk into a root.
+	const i32 unknown = -1, visiting = -2;
+	Vector<i32> depth(count, unknown);
+	Vector<u32> path;
+	i32 maxDepth = 0;
+	for (u32 i = 0; i < count; i++) {
+		if (!owners[i] || depth[i] != unknown) continue;
+
+		path.clear();
+		i32 base = -1;
+		for (u32 cur = i;;) {
+			if (depth[cur] >= 0) {
+				base = depth[cur];
+				break;
+			}
+			if (depth[cur] == visiting) {
+				parentOf[path.back()] = -1;
+				break;
+			}
+			depth[cur] = visiting;
+			path.push_back(cur);
+			if (parentOf[cur] < 0) break;
+			cur = parentOf[cur];
+		}
+
+		for (u32 k = path.size(); k > 0; k--) {
+			depth[path[k - 1]] = ++base;
+		}
+		maxDepth = std::max(maxDepth, base);
+	}
+
+	// Counting sort by depth, keeping the old order within a level
+	Vector<u32> offsets(maxDepth + 2, 0);
+	for (u32 i = 0; i < count; i++) {
+		if (depth[i] >= 0) offsets[depth[i] + 1]++;
+	}
+	for (u32 d = 1; d < offsets.size(); d++) {
+		offsets[d] += offsets[d - 1];
+	}
+
+	Vector<u32> remap(count, ~0u);
+	for (u32 i = 0; i < count; i++) {
+		if (depth[i] >= 0) remap[i] = offsets[depth[i]]++;
+	}
+
+	const u32 live = offsets[maxDepth];
+	Vector<Node> nodes(live);
+	Vector<Local> locals(live);
+	Vector<Mat4> local(live), global(live);
+	Vector<u8> dirty(live);
+	m_firstDirty = ~0u;
+	for (u32 i = 0; i < count; i++) {
+		u32 to = remap[i];
+		if (to == ~0u) continue;
+
+		// A node whose resolved parent changed needs a new world matrix
+		i32 parent = parentOf[i];
+		i32 oldParent = m_nodes[i].parentIndex;
+		bool moved = (parent < 0) != (oldParent < 0) ||
+			(parent >= 0 && m_nodes[oldParent].entity != m_nodes[parent].entity);
+
+		nodes[to] = m_nodes[i];
+		nodes[to].parentIndex = parent < 0 ? -1 : i32(remap[parent]);
+		locals[to] = m_locals[i];
+		local[to] = m_local[i];
+		global[to] = m_world[i];
+		dirty[to] = m_dirty[i] || moved;
+		if (dirty[to]) m_firstDirty = std::min(m_firstDirty, to);
+		owners[i]->m_node = to;
+	}
+
+	m_nodes = mov(nodes);
+	m_locals = mov(locals);
+	m_local = mov(local);
+	m_world = mov(global);
+	m_dirty = mov(dirty);
+	m_depth = maxDepth;
+	m_rebuild = false;
+}
+
+NS_END
@@ -0,0 +1,73 @@
+#ifndef TRANSFORM_SYSTEM_H
+#define TRANSFORM_SYSTEM_H
+
+#include "../core/types.h"
+#include "../core/ecs.h"
+#include "../components/transform.h"
+#include "../math/trs.h"
+
+NS_BEGIN
+
+/// Keeps the local and world matrices of every Transform in flat arrays sorted parent-first,
+/// so one linear pass recomputes the world matrices of whatever changed (and everything below
+/// it) and writes them back to the Transforms, flagging them as changed. Register it after the
+/// systems that move things.
+///
+/// Only Transforms flagged as changed since the previous refresh are looked at, so edit them
+/// through Entity::modify<Transform>() (or markChanged()). A frame where nothing moved costs
+/// next to nothing, whatever the number of Transforms.
+class TransformSystem : public EntitySystem {
+public:
+	TransformSystem();
+
+	void update(EntityWorld& world, float dt) override;
+
+	/// Brings every cached world matrix up to date. update() calls it, editors that don't
+	/// update the world can call it directly.
+	void refresh(EntityWorld& world);
+
+	u32 nodeCount() const { return m_nodes.size(); }
+
+	/// Depth of the deepest node, 0 when everything is a root.
+	u32 depth() const { return m_depth; }
+
+private:
+	struct Node {
+		u64 entity;
+		u64 parent;
+		i32 parentIndex;
+	};
+
+	struct Local {
+		Vec3 position, scale;
+		Quat rotation;
+	};
+
+	// All indexed by node, parents always come before their children
+	Vector<Node> m_nodes;
+	Vector<Local> m_locals;
+	Vector<Mat4> m_local, m_world;
+	Vector<u8> m_dirty;
+
+	// Nodes before this one are clean, and so are their children since those come later
+	u32 m_firstDirty{ ~0u };
+
+	// Entities whose Transform got a new world matrix in the last refresh
+	Vector<u64> m_written;
+
+	// Local TRS of the nodes that moved this refresh, composed in one go
+	TRSBatch m_batch;
+	Vector<u32> m_batchNodes;
+	Vector<Mat4> m_composed;
+
+	u32 m_since{ 0 }, m_depth{ 0 };
+	bool m_rebuild{ false };
+
+	u32 addNode(u64 entity);
+	void markDirty(u32 node);
+	void rebuild(EntityWorld& world);
+};
+
+NS_END
+
+#endif // TRANSFORM_SYSTEM_H